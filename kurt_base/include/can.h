@@ -6,7 +6,47 @@
 
 #include <linux/can.h>
 
-class CAN
+#include <boost/thread/mutex.hpp>
+
+// in ms, a send never blocks longer (full TX queue, bus off)
+#define CAN_SEND_TIMEOUT 10
+
+/**
+ * Frame level access to the Kurt CAN bus. receive_frame blocks until the
+ * next frame arrives or the transport gives up.
+ */
+class CANTransport
+{
+  public:
+    virtual ~CANTransport() { }
+    virtual bool send_frame(const can_frame *frame) = 0;
+    virtual bool receive_frame(can_frame *frame) = 0;
+    // reception time of the last received frame in s since the epoch, 0 if unknown
+    virtual double stamp() const { return 0.0; }
+};
+
+// in s, no frame for this long means Kurt is switched off
+#define CAN_RECEIVE_TIMEOUT 1
+
+// reconnect backoff in s
+#define CAN_BACKOFF_MIN 0.1
+#define CAN_BACKOFF_MAX 2.0
+
+/**
+ * SocketCAN on can0.
+ *
+ * A missing interface, an interface going down or a bus off closes the
+ * socket, it is reopened (and the error filter restored) with exponential
+ * backoff from within receive_frame. receive_frame sleeps at most
+ * CAN_BACKOFF_MIN per call while disconnected, so the caller's loop keeps
+ * running.
+ *
+ * send_frame may be called from any thread (watchdog, rotunit). Only the
+ * thread of receive_frame opens and closes the socket, a send that finds the
+ * link lost leaves the reconnect to it. The mutex keeps the socket open
+ * during a send.
+ */
+class CAN : public CANTransport
 {
   public:
     CAN();
@@ -15,8 +55,22 @@ class CAN
     bool send_frame(const can_frame *frame);
     bool receive_frame(can_frame *frame);
 
+    double stamp() const { return stamp_; }
+
+    bool connected() const;
+
   private:
+    bool connect();
+    void disconnect();
+    bool link_lost(int error) const;
+
+    // socket and reconnect state
+    mutable boost::mutex mutex_;
     int cansocket_;
+    bool link_lost_; // seen by send_frame, reconnect in receive_frame
+    double backoff_; // in s
+    double next_connect_; // monotonic s
+    double stamp_;
 };
 
 #endif
@@ -1,20 +1,41 @@
 #ifndef _COMM_H_
 #define _COMM_H_
 
+#include "local_grid.h"
+#include "mcu_health.h"
+
 class Comm
 {
   public:
     virtual ~Comm() { }
+    // covariances in ROS conventions: pose of x, y, yaw and twist of v,
+    // v_angular, row major
     virtual void send_odometry(double z, double x, double theta, double v_encoder,
-        double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right) = 0;
+        double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right,
+        const double *pose_covariance, const double *twist_covariance) = 0;
     virtual void send_sonar_leftBack(int ir_left_back) = 0;
     virtual void send_sonar_front_usound_leftFront_left(int ir_right_front, int
         usound, int ir_left_front, int ir_left) = 0;
     virtual void send_sonar_back_rightBack_rightFront(int ir_back, int
         ir_right_back, int ir_right) = 0;
-    virtual void send_pitch_roll(double pitch, double roll) = 0;
-    virtual void send_gyro(double theta, double sigma) = 0;
+    // angles in rad, yaw_rate in rad/s, stamp in s since the epoch (0: now)
+    virtual void send_imu(double roll, double pitch, double yaw, double yaw_rate,
+        double tilt_variance, double yaw_variance, double stamp) = 0;
+    // fused pose in m and rad, covariance of x, y, yaw row major, stamp as above
+    virtual void send_odom_combined(double x, double y, double yaw, const double *covariance,
+        double stamp) = 0;
+    // learned turning adaptation, slip of the tracks relative to the configured one
+    virtual void send_slip(double turning_adaptation, double slip_left, double slip_right) = 0;
+    virtual void send_mcu_health(const McuHealth &health) = 0;
+    // pose difference of host and micro controller odometry over a check period
+    virtual void send_odometry_check(double position_error, double yaw_error, bool consistent) = 0;
+    // stamp as above
+    virtual void send_local_grid(const LocalGrid &grid, double stamp) = 0;
     virtual void send_rotunit(double rot) = 0;
+    virtual void send_bumper(int bumper, int remote_control, bool stopped) = 0;
+    // called from the watchdog thread
+    virtual void send_watchdog(bool tripped, const char *reason) = 0;
+    virtual void send_can_available(bool available) = 0;
 };
 
 #endif
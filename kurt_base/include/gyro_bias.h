@@ -0,0 +1,48 @@
+#ifndef _GYRO_BIAS_H_
+#define _GYRO_BIAS_H_
+
+/**
+ * Online drift compensation of the integrated gyro heading of the Kurt micro
+ * controller.
+ *
+ * While the odometry says the robot is standing, every heading change is
+ * drift. The drift per frame is learned as a running mean that turns into an
+ * exponential average over window frames, so the first estimate is there
+ * after a few frames and later ones follow slow changes (temperature).
+ * Changes larger than max_delta are never drift (e.g. the base was switched
+ * off and on again) and are ignored. The accumulated drift is subtracted
+ * from every heading.
+ */
+class GyroBiasEstimator
+{
+  public:
+    GyroBiasEstimator(double max_delta, int window);
+
+    void setParameters(double max_delta, int window);
+
+    /**
+     * @param theta raw heading in rad
+     * @param standing the robot does not move
+     * @return corrected heading in rad
+     */
+    double update(double theta, bool standing);
+
+    // the next heading continues from the current corrected one, for a
+    // restarted micro controller
+    void rebase() { first_ = true; }
+
+    double bias() const { return bias_; } // in rad per frame
+
+  private:
+    double max_delta_; // in rad per frame
+    int window_;
+
+    bool first_;
+    int samples_;
+    double bias_;
+    double error_; // accumulated drift (and start offset)
+    double last_theta_;
+    double yaw_;
+};
+
+#endif
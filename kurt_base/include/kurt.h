@@ -1,15 +1,34 @@
 #ifndef _KURT_H_
 #define _KURT_H_
 
+#include <cmath>
 #include <string>
+#include <vector>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
 
 #include <linux/can.h>
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "can.h"
 #include "comm.h"
+#include "gyro_bias.h"
+#include "kurt_clock.h"
+#include "local_grid.h"
+#include "mcu_health.h"
+#include "mcu_odometry.h"
+#include "odometry_covariance.h"
+#include "odometry_ekf.h"
+#include "orientation_filter.h"
+#include "pwm_table.h"
+#include "slip_estimator.h"
+#include "velocity_filter.h"
+#include "watchdog.h"
 
 //CAN IDs
 #define CAN_CONTROL    0x00000001 // control message
@@ -18,25 +37,30 @@
 #define CAN_ADC08_11   0x00000007 // analog input channels: 8 - 11
 #define CAN_ENCODER    0x00000009 // 2 motor encoders
 #define CAN_TILT_COMP  0x0000000D // data from tilt sensor
+#define CAN_INFO_1     0x00000004 // info message (hardware identification, firmware version, loop count): hw_id[2], fw_version[2], loop[4]
+#define CAN_ADC12_15   0x00000008 // analog input channels: 12 - 15, motor current right and left in milli Amper, adc channel 14, board temperature
+#define CAN_DEADRECK   0x0000000B // position as ascertained by odometry: position_x[3], position_y[3], orientation[2]
+#define CAN_GETSPEED   0x0000000C // current transl. and rot. speed (MACS spec say accumulated values of left and right motor's encoders: enc_odo_left[4], enc_odo_right[4]
 #define CAN_GYRO_MC1   0x0000000E // data from gyro connected to 1st C167
+#define CAN_GYRO_MC2   0x0000001E // data from gyro connected to 2nd C167
+#define CAN_BUMPERC    0x0000000A // bumpers and remote control: bumper[1], remote_control[1]
 #define CAN_GETROTUNIT 0x00000010 // current rotunit angle
 #define CAN_SETROTUNT  0x00000080 // send rotunit speed
 
 //unused CAN IDs
-#define CAN_INFO_1     0x00000004 // info message (hardware identification, firmware version, loop count): hw_id[2], fw_version[2], loop[4]
-#define CAN_ADC12_15   0x00000008 // analog input channels: 12 - 15, motor current right and left in milli Amper, adc channel 14, board temperature
-#define CAN_BUMPERC    0x0000000A // bumpers and remote control
-#define CAN_DEADRECK   0x0000000B // position as ascertained by odometry: position_x[3], position_y[3], orientation[2]
-#define CAN_GETSPEED   0x0000000C // current transl. and rot. speed (MACS spec say accumulated values of left and right motor's encoders: enc_odo_left[4], enc_odo_right[4]
 #define CAN_BDC00_03   0x00000015 // analog input channels: 0 - 3
 #define CAN_BDC04_07   0x00000016 // analog input channels: 4 - 7
 #define CAN_BDC08_11   0x00000017 // analog input channels: 8 - 11
 #define CAN_BDC12_15   0x00000018 // analog input channels: 12 - 15
-#define CAN_GYRO_MC2   0x0000001E // data from gyro connected to 2nd C167
 
 #define RAW            0          // raw control mode
 #define SPEED_CM       2          // speed (cm/s) control mode
-#define MAX_V_LIST     200
+
+#define HARD_STOP_TRIES 3
+
+// CAN_DEADRECK: x forward, y left in mm, orientation counterclockwise over the full 16 bit
+#define DEADRECK_POSITION_SCALE    0.001 // [m]
+#define DEADRECK_ORIENTATION_SCALE (2.0 * M_PI / 65536.0) // [rad]
 
 // values from Sharp GP2D12 IR ranger data sheet
 #define IR_MIN         0.10 // [m]
@@ -53,34 +77,134 @@ class Kurt
   public:
     Kurt(
         Comm &comm,
+        CANTransport &can,
         double wheel_perimeter,
         double axis_length,
         double turning_adaptation,
         int ticks_per_turn_of_wheel) :
+      can_(can),
       comm_(comm),
       wheel_perimeter_(wheel_perimeter),
       axis_length_(axis_length),
       turning_adaptation_(turning_adaptation),
       ticks_per_turn_of_wheel_(ticks_per_turn_of_wheel),
+      x_from_encoder_(0.0),
+      z_from_encoder_(0.0),
+      theta_from_encoder_(0.0),
+      odom_covariance_(0.01, wheel_perimeter / ticks_per_turn_of_wheel, axis_length, turning_adaptation),
+      odometry_source_(ODOMETRY_HOST),
+      mcu_odometry_(1.0, 0.02, 0.05, 0.05),
+      received_ticks_l_(0),
+      received_ticks_r_(0),
       use_microcontroller_(true),
       use_rotunit_(false),
+      mc_anti_windup_(false),
+      bumper_mask_(0),
+      remote_control_mask_(0),
+      bumper_contact_(false),
+      bumper_stop_(false),
+      emergency_stop_(false),
+      resume_(false),
+      can_available_(false),
+      clock_(&monotonic_clock_),
+      last_frame_time_(0.0),
+      rotunit_closed_loop_(false),
+      rotunit_target_(0.0),
+      rotunit_command_(0.0),
+      rotunit_integral_(0.0),
+      rotunit_last_angle_(0.0),
+      rotunit_window_angle_(0.0),
+      rotunit_window_start_(-1.0),
       nr_v_(1000),
       leerlauf_adapt_(0),
+      feedforward_turn_(0.0),
+      v_filter_l_(new MovingAverageFilter(4)),
+      v_filter_r_(new MovingAverageFilter(4)),
+      max_v_jump_(0.19),
+      zl_(0.0), zr_(0.0),
+      last_zl_(0.0), last_zr_(0.0),
+      el_(0.0), er_(0.0),
+      last_el_(0.0), last_er_(0.0),
+      int_el_(0.0), int_er_(0.0),
+      last_v_l_ist_(0.0), last_v_r_ist_(0.0),
+      last_anti_windup_(1.0),
+      learn_feedforward_(false),
+      learn_save_pending_(false),
+      learn_stop_(false),
       v_encoder_left_(0.0),
-      v_encoder_right_(0.0) { }
+      v_encoder_right_(0.0),
+      standing_cycles_(0),
+      gyro_bias_(2.0 * M_PI / 120.0 * 0.01, 1000),
+      gyro_mc1_seen_(false),
+      orientation_(1.0, 1.0),
+      tilt_variance_(0.0004),
+      last_v_encoder_(0.0),
+      acceleration_lin_(0.0),
+      acceleration_(0.0),
+      frame_stamp_(0.0),
+      tilt_stamp_(0.0),
+      gyro_stamp_(0.0),
+      ekf_gyro_variance_(0.0),
+      mcu_(1.0, 10.0, 70.0, 0.1, 24.0),
+      grid_publish_cycles_(50),
+      grid_cycles_(0) { }
     ~Kurt();
 
     bool setPWMData(const std::string &speedPwmLeerlaufTable, double feedforward_turn, double ki, double kp);
+    bool setGainTable(const std::string &gainTable);
+    bool setVelocityFilter(const std::string &type, int window, double alpha,
+        double process_noise, double measurement_noise, double max_jump);
+    void setFeedforwardLearning(const std::string &learnedTable, double rate, double max_step,
+        int width, double save_period);
+    void setMCAntiWindup(bool anti_windup) { mc_anti_windup_ = anti_windup; }
+    // stddev of a wheel distance after 1 m in m, grows with the square root
+    void setWheelNoise(double wheel_noise) { odom_covariance_.setWheelNoise(wheel_noise); }
+    // occupancy grid of the IR and sonar ranges, cell size in m, published every publish_period s
+    void setLocalGrid(double resolution, double publish_period);
+    // NULL if disabled, only valid in the thread of can_read_fifo
+    const LocalGrid *localGrid() const { return grid_.get(); }
+    // check period in s, errors per period: max_error in m plus
+    // max_relative_error per m driven, max_yaw_error in rad
+    void setOdometrySource(OdometrySource source, double check_period, double max_error,
+        double max_relative_error, double max_yaw_error);
+    /**
+     * Brake when a masked bit of CAN_BUMPERC is set. Byte 0 holds one bit per
+     * bumper contact, byte 1 the remote control buttons. Which bit is which
+     * contact depends on the wiring of the robot, see the bumper and
+     * remote_control topics. 0 disables the stop.
+     */
+    void setBumperStop(int bumper_mask, int remote_control_mask);
+    // time of the timeouts and of frames the transport does not stamp,
+    // monotonic by default, must outlive the Kurt object
+    void setClock(Clock &clock) { clock_ = &clock; }
+    // max_drift in rad/s, time_constant in s of the drift average
+    void setGyroBiasEstimation(double max_drift, double time_constant);
+    // tau in s of the tilt correction, which fades out up to max_acceleration in m/s^2
+    void setOrientationFilter(double tau, double max_acceleration, double tilt_stddev);
+    // fuse encoders and gyro to odom_combined, noise in stddev per m driven
+    // and per rad turned, gyro_stddev in rad is the lower bound of the gyro sigma
+    void setOdometryEKF(double distance_noise, double turn_noise, double gyro_stddev);
+    // learn the turning adaptation per track from the gyro, forgetting per
+    // window of window s, windows with less than min_turn rad of track motion are skipped
+    void setSlipEstimation(double forgetting, double window, double min_turn);
+    // report period in s, limits in A and deg C, cycle_tolerance relative to
+    // 10 ms, supply voltage in V
+    void setMcuMonitor(double period, double max_current, double max_temperature,
+        double cycle_tolerance, double voltage);
+    void startWatchdog(double command_timeout, double rx_timeout, double control_deadline, double period);
+    // feeds the command age check of the watchdog
+    void commandReceived(bool moving);
 
     int can_motor(int left_pwm,  char left_dir,  char left_brake,
         int right_pwm, char right_dir, char right_brake);
-    void set_wheel_speed(double _v_l_soll, double _v_r_soll, double _AntiWindup);
+    void set_wheel_speed(double _v_l_soll, double _v_r_soll, double _omega, double _AntiWindup);
     int can_read_fifo();
 
     void can_rotunit_send(double speed);
+    void setRotunitControl(double kp, double ki, double period);
 
   private:
-    CAN can_;
+    CANTransport &can_;
     Comm &comm_;
 
     //odometry
@@ -88,21 +212,137 @@ class Kurt
     double axis_length_;
     double turning_adaptation_;
     int ticks_per_turn_of_wheel_;
+    double x_from_encoder_, z_from_encoder_, theta_from_encoder_;
+    OdometryCovariance odom_covariance_;
+    OdometrySource odometry_source_;
+    McuOdometry mcu_odometry_;
+    long received_ticks_l_, received_ticks_r_; // sum of the encoder frames
 
     bool use_microcontroller_;
     bool use_rotunit_;
+    // only safe with jerk limited setpoints, see set_wheel_speed
+    bool mc_anti_windup_;
+
+    //bumper and remote control stop
+    int bumper_mask_, remote_control_mask_; // bits that stop the robot
+    bool bumper_contact_;
+    bool bumper_stop_; // latched until the contact is gone and zero speed commanded
+
+    //watchdog stop, only brake frames are sent while set
+    boost::mutex motor_mutex_;
+    bool emergency_stop_;
+    bool resume_; // reset the integrators on the next cycle
+    void emergencyStop(Watchdog::Reason reason);
+    void releaseEmergencyStop();
+    bool send_motor_frame(const can_frame &frame, bool brake);
+
+    //CAN link
+    bool can_available_; // frames arrive from Kurt
+    MonotonicClock monotonic_clock_;
+    Clock *clock_;
+    double last_frame_time_; // s of clock_
+    void set_can_available(bool available);
+
+    //rotunit speed control
+    bool rotunit_closed_loop_;
+    double rotunit_kp_, rotunit_ki_;
+    double rotunit_period_; // measurement window in s
+    double rotunit_target_; // in rad/s
+    double rotunit_command_; // in rad/s, target plus trim
+    double rotunit_integral_;
+    double rotunit_last_angle_;
+    double rotunit_window_angle_; // unwrapped angle covered in the window
+    double rotunit_window_start_; // in s, < 0 until the first angle arrives
 
     //PWM data
     const int nr_v_;
     double vmax_;
-    int *pwm_v_l_, *pwm_v_r_;
+    PwmTable pwm_v_;
     double kp_l, kp_r; // schnell aenderung folgen
     double ki_l, ki_r; // integrierer relative langsam
+    // speed dependent gains, overwrite kp_l/kp_r/ki_l/ki_r if not empty
+    struct Gains
+    {
+      double v; // in m/s
+      double kp_l, ki_l, kp_r, ki_r;
+    };
+    std::vector<Gains> gain_table_;
     int leerlauf_adapt_;
     double feedforward_turn_; // in v = m/s
+    // encoder speed smoothing for the PI controller
+    boost::scoped_ptr<VelocityFilter> v_filter_l_, v_filter_r_;
+    double max_v_jump_; // larger changes are measurement errors, in m/s
+    // PI controller state: stellgroessen, regelabweichung, integral
+    double zl_, zr_;
+    double last_zl_, last_zr_;
+    double el_, er_;
+    double last_el_, last_er_;
+    double int_el_, int_er_;
+    double last_v_l_ist_, last_v_r_ist_; // filter fuer gueltige Werte
+    double last_anti_windup_; // the filters restart when it drops to 0
+
+    //online feedforward (speedtable) learning
+    bool learn_feedforward_;
+    std::string learned_table_file_;
+    double learn_rate_;
+    double learn_max_step_; // in pwm per update
+    int learn_width_; // in table entries
+    int learn_save_cycles_;
+    int learn_cycle_;
+    bool learn_dirty_;
+    int learn_steady_[2]; // cycles with constant setpoint
+    double learn_v_soll_[2];
+    std::vector<double> v_pwm_l_, v_pwm_r_; // forward table, for saving
+    // copy of what the writer thread needs, the control loop never waits for the disk
+    struct LearnedTable
+    {
+      std::string filename;
+      PwmTable pwm_v;
+      std::vector<double> v_pwm_l, v_pwm_r;
+      double vmax;
+    };
+    LearnedTable learn_save_;
+    bool learn_save_pending_;
+    bool learn_stop_;
+    boost::mutex learn_mutex_;
+    boost::condition_variable learn_cond_;
+    boost::thread learn_writer_;
     // speed from encoder in m/s
     double v_encoder_left_, v_encoder_right_;
 
+    //gyro
+    int standing_cycles_; // encoder frames without wheel motion
+    GyroBiasEstimator gyro_bias_;
+    bool gyro_mc1_seen_;
+
+    //orientation from tilt sensor and gyro
+    OrientationFilter orientation_;
+    double tilt_variance_;
+    double last_v_encoder_;
+    double acceleration_lin_, acceleration_; // in m/s^2
+    // reception stamps in s since the epoch, 0 if unknown
+    double frame_stamp_, tilt_stamp_, gyro_stamp_;
+    double frame_dt(double &last_stamp);
+
+    //turning adaptation per track, NULL if static
+    boost::scoped_ptr<SlipEstimator> slip_;
+
+    //fused pose, NULL if disabled
+    boost::scoped_ptr<OdometryEKF> ekf_;
+    double ekf_gyro_variance_;
+
+    //micro controller health
+    McuMonitor mcu_;
+
+    //near field obstacles, NULL if disabled
+    boost::scoped_ptr<LocalGrid> grid_;
+    int grid_publish_cycles_; // encoder frames
+    int grid_cycles_;
+    void grid_range(int sensor, int range);
+
+    // last member, its thread is stopped before the rest is destroyed
+    boost::scoped_ptr<Watchdog> watchdog_;
+
     //motor
     void k_hard_stop(void);
     void set_wheel_speed1(double v_l, double v_r, int integration_l, int integration_r);
@@ -111,10 +351,15 @@ class Kurt
     void set_wheel_speed2_mc(double _v_l_soll, double _v_r_soll, double _omega,
         double _AntiWindup);
     void odometry(int wheel_a, int wheel_b);
+    double integrate_odometry(double wheel_L, double wheel_R, double time_diff);
     bool read_speed_to_pwm_leerlauf_tabelle(const std::string &filename, int *nr,
         double **v_pwm_l, double **v_pwm_r);
-    void make_pwm_v_tab(int nr, double *v_pwm_l, double *v_pwm_r, int nr_v, int
-        **pwm_v_l, int **pwm_v_r, double *v_max);
+    bool read_gain_table(const std::string &filename, std::vector<Gains> &table);
+    void schedule_gains(double v_l, double v_r);
+    void learn_pwm_v_tab(int wheel, double v_soll, double z, double e);
+    void save_learned_table();
+    void run_learn_writer();
+    static bool write_speed_to_pwm_leerlauf_tabelle(const LearnedTable &table);
 
     //sensors
     void can_encoder(const can_frame &frame);
@@ -124,9 +369,17 @@ class Kurt
     void can_sonar4_7(const can_frame &frame);
     void can_sonar0_3(const can_frame &frame);
     void can_tilt_comp(const can_frame &frame);
-    void can_gyro_mc1(const can_frame &frame);
+    void can_gyro(const can_frame &frame, int mc);
+    void can_bumperc(const can_frame &frame);
+    void can_info(const can_frame &frame);
+    void can_adc12_15(const can_frame &frame);
+    void can_deadreck(const can_frame &frame);
+    void can_getspeed(const can_frame &frame);
+    void report_mcu_health();
 
     void can_rotunit(const can_frame &frame);
+    bool can_rotunit_send_ticks(double speed);
+    void rotunit_control(double rot);
 };
 
 #endif
@@ -0,0 +1,44 @@
+#ifndef _KURT_BASE_H_
+#define _KURT_BASE_H_
+
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+
+#include "can.h"
+#include "kurt.h"
+#include "ros_call.h"
+#include "ros_comm.h"
+
+/**
+ * The kurt_base driver, shared by the node and the nodelet: init() reads the
+ * parameters from nh_ns and starts Kurt, which publishes and subscribes on n.
+ *
+ * Kurt is not thread safe, so the callback queue of n has to be served by
+ * the thread that calls read().
+ */
+class KurtBase
+{
+  public:
+    KurtBase(const ros::NodeHandle &n, const ros::NodeHandle &nh_ns);
+
+    // false on an invalid parameter or table
+    bool init();
+    // waits for the next CAN frame and handles it
+    void read() { kurt_->can_read_fifo(); }
+
+  private:
+    ros::NodeHandle n_;
+    ros::NodeHandle nh_ns_;
+
+    CAN can_;
+    boost::scoped_ptr<ROSComm> roscomm_;
+    boost::scoped_ptr<Kurt> kurt_;
+    boost::scoped_ptr<ROSCall> roscall_;
+
+    ros::Timer pid_timer_;
+    ros::Subscriber cmd_vel_sub_;
+    ros::Subscriber rot_vel_sub_;
+};
+
+#endif
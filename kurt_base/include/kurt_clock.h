@@ -0,0 +1,26 @@
+#ifndef _KURT_CLOCK_H_
+#define _KURT_CLOCK_H_
+
+// CLOCK_MONOTONIC in s
+double monotonic_seconds();
+
+/**
+ * Time base of the Kurt core for timeouts and reception times that the CAN
+ * transport does not stamp, monotonic by default. A simulation replaces it
+ * with its own time.
+ */
+class Clock
+{
+  public:
+    virtual ~Clock() { }
+    // in s
+    virtual double now() = 0;
+};
+
+class MonotonicClock : public Clock
+{
+  public:
+    double now() { return monotonic_seconds(); }
+};
+
+#endif
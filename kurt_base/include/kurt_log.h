@@ -0,0 +1,47 @@
+#ifndef _KURT_LOG_H_
+#define _KURT_LOG_H_
+
+/**
+ * Logging of the Kurt core without ROS. The messages go to stderr (debug
+ * messages are dropped) until a handler is set, e.g. one that forwards them
+ * to rosconsole.
+ */
+
+enum KurtLogLevel
+{
+  KURT_LOG_DEBUG,
+  KURT_LOG_INFO,
+  KURT_LOG_WARN,
+  KURT_LOG_ERROR,
+  KURT_LOG_FATAL
+};
+
+typedef void (*KurtLogHandler)(KurtLogLevel level, const char *message);
+
+// NULL restores stderr
+void setKurtLogHandler(KurtLogHandler handler);
+
+void kurt_log(KurtLogLevel level, const char *format, ...)
+  __attribute__ ((format (printf, 2, 3)));
+// true at most once per period s for each last, thread safe
+bool kurt_log_throttle(double &last, double period);
+
+#define KURT_DEBUG(...) kurt_log(KURT_LOG_DEBUG, __VA_ARGS__)
+#define KURT_INFO(...)  kurt_log(KURT_LOG_INFO, __VA_ARGS__)
+#define KURT_WARN(...)  kurt_log(KURT_LOG_WARN, __VA_ARGS__)
+#define KURT_ERROR(...) kurt_log(KURT_LOG_ERROR, __VA_ARGS__)
+#define KURT_FATAL(...) kurt_log(KURT_LOG_FATAL, __VA_ARGS__)
+
+#define KURT_LOG_THROTTLE(level, period, ...) \
+  do \
+  { \
+    static double kurt_log_last_ = -1.0e9; \
+    if (kurt_log_throttle(kurt_log_last_, period)) \
+      kurt_log(level, __VA_ARGS__); \
+  } while (0)
+
+#define KURT_INFO_THROTTLE(period, ...)  KURT_LOG_THROTTLE(KURT_LOG_INFO, period, __VA_ARGS__)
+#define KURT_WARN_THROTTLE(period, ...)  KURT_LOG_THROTTLE(KURT_LOG_WARN, period, __VA_ARGS__)
+#define KURT_ERROR_THROTTLE(period, ...) KURT_LOG_THROTTLE(KURT_LOG_ERROR, period, __VA_ARGS__)
+
+#endif
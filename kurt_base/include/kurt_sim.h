@@ -0,0 +1,101 @@
+#ifndef _KURT_SIM_H_
+#define _KURT_SIM_H_
+
+#include <string>
+#include <vector>
+
+#include "can.h"
+#include "comm.h"
+#include "kurt_clock.h"
+
+/**
+ * Hardware-free Kurt: a CAN transport that answers the RAW control frames of
+ * Kurt::can_motor with the encoder frames of a simulated drive.
+ *
+ * Each track is a first order lag towards the steady state speed of the
+ * commanded pwm, which is taken from a speedtable recorded on the robot
+ * (so the simulated robot is the one the table was measured on). The time
+ * constant is not part of the tables and has to be given. load scales the
+ * steady state speeds, < 1 for a surface heavier than the one of the table.
+ *
+ * Every receive_frame advances the simulation by one encoder period
+ * (10 ms) and returns its CAN_ENCODER frame, so the controller runs as fast
+ * as the host allows. As the Clock of Kurt it keeps the timeouts on the
+ * simulated time.
+ */
+class KurtSimulator : public CANTransport, public Clock
+{
+  public:
+    KurtSimulator(double wheel_perimeter, int ticks_per_turn_of_wheel,
+        double tau, double load, double encoder_noise, unsigned int seed);
+
+    bool loadSpeedtable(const std::string &filename);
+
+    bool send_frame(const can_frame *frame);
+    bool receive_frame(can_frame *frame);
+
+    // true track speed in m/s, 0 = left, 1 = right
+    double speed(int wheel) const { return v_[wheel]; }
+    // simulated time in s
+    double time() const { return time_; }
+    double now() { return time_; }
+
+  private:
+    double steadyStateSpeed(int wheel) const;
+    double gaussian();
+
+    double wheel_perimeter_;
+    int ticks_per_turn_of_wheel_;
+    double tau_; // in s
+    double load_;
+    double encoder_noise_; // standard deviation in ticks per frame
+    unsigned int seed_;
+
+    std::vector<double> v_pwm_[2]; // speed over pwm, from the speedtable
+    int pwm_[2]; // as sent, 1023 = zero, 0 = maxspeed
+    bool backward_[2];
+    bool brake_[2];
+    double v_[2];
+    double ticks_[2]; // not yet reported fractions of ticks
+    double time_;
+};
+
+// discards everything Kurt reports
+class NullComm : public Comm
+{
+  public:
+    void send_odometry(double z, double x, double theta, double v_encoder, double v_encoder_angular,
+        int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right,
+        const double *pose_covariance, const double *twist_covariance) { }
+    void send_sonar_leftBack(int ir_left_back) { }
+    void send_sonar_front_usound_leftFront_left(int ir_right_front, int usound, int ir_left_front, int ir_left) { }
+    void send_sonar_back_rightBack_rightFront(int ir_back, int ir_right_back, int ir_right) { }
+    void send_imu(double roll, double pitch, double yaw, double yaw_rate,
+        double tilt_variance, double yaw_variance, double stamp) { }
+    void send_odom_combined(double x, double y, double yaw, const double *covariance,
+        double stamp) { }
+    void send_slip(double turning_adaptation, double slip_left, double slip_right) { }
+    void send_mcu_health(const McuHealth &health) { }
+    void send_odometry_check(double position_error, double yaw_error, bool consistent) { }
+    void send_local_grid(const LocalGrid &grid, double stamp) { }
+    void send_rotunit(double rot) { }
+    void send_bumper(int bumper, int remote_control, bool stopped) { }
+    void send_watchdog(bool tripped, const char *reason) { }
+    void send_can_available(bool available) { }
+};
+
+/**
+ * Step response of one track, recorded every 10 ms from rest.
+ */
+struct StepResponse
+{
+  double rise_time; // 10 % to 90 % of the step in s, < 0 if not reached
+  double overshoot; // relative to the step
+  double steady_state_error; // mean over the last second in m/s
+  double iae; // integrated absolute error in m
+
+  StepResponse() : rise_time(-1.0), overshoot(0.0), steady_state_error(0.0), iae(0.0) { }
+  static StepResponse evaluate(const std::vector<double> &v, double v_soll, double dt);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _LOCAL_GRID_H_
+#define _LOCAL_GRID_H_
+
+#include <stdint.h>
+
+#define LOCAL_GRID_SIZE     64   // cells per side, a power of 2
+#define LOCAL_GRID_OCCUPIED 20   // log-odds increment of a hit
+#define LOCAL_GRID_FREE     -5   // log-odds increment of a miss
+#define LOCAL_GRID_MAX      100  // log-odds bound, 0 is unknown
+
+/**
+ * Rolling occupancy grid around Kurt for the IR and sonar ranges, the cells
+ * are int8 log-odds times 20.
+ *
+ * The grid is aligned with the odometry frame and follows the robot in whole
+ * cells: the cells are a ring buffer in both directions, so a shift only
+ * clears the rows and columns that scroll in. Each range updates the cells
+ * of its cone once, free in front of the measured range, occupied at it.
+ * Positions of the query functions are relative to the robot in its own
+ * frame (ROS conventions).
+ */
+class LocalGrid
+{
+  public:
+    explicit LocalGrid(double resolution);
+
+    // pose of the robot in the odometry frame, in m and rad
+    void move(double x, double y, double yaw);
+
+    /**
+     * @param x, y, yaw pose of the sensor on the robot
+     * @param fov opening angle in rad
+     * @param range in m, max_range for no echo
+     */
+    void insertRange(double x, double y, double yaw, double fov, double range, double max_range);
+
+    // log-odds at a point relative to the robot, 0 outside of the grid
+    int8_t logOdds(double x, double y) const;
+    bool occupied(double x, double y) const { return logOdds(x, y) > 0; }
+
+    double resolution() const { return resolution_; }
+    // odometry frame coordinates of the lower corner of cell (0, 0) of row()
+    double originX() const { return origin_x_ * resolution_; }
+    double originY() const { return origin_y_ * resolution_; }
+    // row j (y) of LOCAL_GRID_SIZE cells (x) from the lower corner
+    void row(int j, int8_t *cells) const;
+
+  private:
+    double resolution_;
+    // lower corner of the grid in cells, in the odometry frame
+    long origin_x_, origin_y_;
+    double x_, y_, yaw_;
+
+    int8_t cells_[LOCAL_GRID_SIZE * LOCAL_GRID_SIZE];
+
+    // cell in the odometry frame, NULL outside of the grid
+    int8_t *cell(long i, long j);
+    const int8_t *cell(long i, long j) const;
+    void update(int8_t *c, int delta);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _MCU_HEALTH_H_
+#define _MCU_HEALTH_H_
+
+#include <string>
+
+#define MCU_CYCLE_TIME 0.01 // [s], nominal control cycle of the C167
+
+#define MCU_OK    0
+#define MCU_WARN  1
+#define MCU_ERROR 2
+
+// state of the micro controller over one report period
+struct McuHealth
+{
+  int level; // MCU_OK, MCU_WARN or MCU_ERROR
+  std::string message;
+  int hw_id;
+  int firmware_version;
+  double cycle_time; // [s], from the loop counter, 0 if unknown
+  double current_left, current_right; // [A], mean
+  double peak_current_left, peak_current_right; // [A]
+  double power_left, power_right; // [W], mean
+  double temperature; // [deg C]
+};
+
+/**
+ * Collects CAN_INFO_1 (loop counter) and CAN_ADC12_15 (motor currents,
+ * board temperature) and checks them against thresholds once per period:
+ * overload if a peak current is above max_current, overheating above
+ * max_temperature, a slow firmware if its cycle is more than
+ * cycle_tolerance (relative) longer than 10 ms. The motor power is the
+ * current times the supply voltage.
+ */
+class McuMonitor
+{
+  public:
+    McuMonitor(double period, double max_current, double max_temperature,
+        double cycle_tolerance, double voltage);
+
+    void setParameters(double period, double max_current, double max_temperature,
+        double cycle_tolerance, double voltage);
+
+    // time in s
+    void info(int hw_id, int firmware_version, unsigned long loop, double time);
+    // currents in A, temperature in deg C
+    void adc(double current_left, double current_right, double temperature);
+
+    // a period is over, health() starts the next one
+    bool due(double time) const { return start_ >= 0.0 && time - start_ >= period_; }
+    const McuHealth &health(double time);
+    // a restarted micro controller counts its loops from 0 again
+    void restart() { loop_valid_ = false; start_ = -1.0; }
+
+  private:
+    double period_;
+    double max_current_;
+    double max_temperature_;
+    double cycle_tolerance_;
+    double voltage_;
+
+    McuHealth health_;
+    double start_; // of the period, < 0 before the first frame
+
+    // loop counter at the first and last info frame of the period
+    bool loop_valid_;
+    unsigned long first_loop_, last_loop_;
+    double first_loop_time_, last_loop_time_;
+
+    int adc_frames_;
+    double sum_current_left_, sum_current_right_;
+    double peak_current_left_, peak_current_right_;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _MCU_ODOMETRY_H_
+#define _MCU_ODOMETRY_H_
+
+// where the published odometry pose comes from
+enum OdometrySource
+{
+  ODOMETRY_HOST, // integrated from CAN_ENCODER
+  ODOMETRY_MCU, // CAN_DEADRECK of the micro controller
+  ODOMETRY_BOTH // host, checked against the micro controller
+};
+
+/**
+ * Odometry of the Kurt micro controller (ROS conventions: x forward, y left,
+ * yaw counterclockwise).
+ *
+ * The dead reckoning pose starts at 0 like the one of the host and continues
+ * from the last pose when the micro controller restarts. The accumulated
+ * encoder ticks of CAN_GETSPEED give the ticks of lost CAN_ENCODER frames:
+ * the difference to the sum of the received ones is lost once it shows up
+ * in two frames in a row, a single one is a frame in flight.
+ *
+ * check() compares the pose increments of host and micro controller in
+ * windows of period s, expressed in the pose at the start of the window.
+ */
+class McuOdometry
+{
+  public:
+    McuOdometry(double period, double max_error, double max_relative_error, double max_yaw_error);
+
+    // max_error in m plus max_relative_error per m driven, max_yaw_error in rad
+    void setParameters(double period, double max_error, double max_relative_error, double max_yaw_error);
+
+    // the micro controller restarted, its counters and pose start from 0
+    void restart();
+
+    /**
+     * @param accumulated ticks counted by the micro controller, left and right
+     * @param received ticks summed up from the received encoder frames
+     * @param lost ticks of lost encoder frames
+     * @return some ticks were lost
+     */
+    bool lostTicks(const long accumulated[2], const long received[2], long lost[2]);
+
+    // raw pose in m and rad
+    void setPose(double x, double y, double yaw);
+    bool poseValid() const { return pose_valid_; }
+    double x() const { return x_; }
+    double y() const { return y_; }
+    double yaw() const { return yaw_; }
+
+    /**
+     * @param x, y, yaw pose of the host
+     * @param time in s
+     * @return a window is complete, its errors in position_error (m) and yaw_error (rad)
+     */
+    bool check(double x, double y, double yaw, double time, double &position_error,
+        double &yaw_error, bool &consistent);
+
+  private:
+    double period_;
+    double max_error_;
+    double max_relative_error_;
+    double max_yaw_error_;
+
+    //lost encoder frames
+    bool ticks_valid_;
+    long base_accumulated_[2], base_received_[2];
+    long last_difference_[2];
+
+    //dead reckoning
+    bool pose_valid_;
+    bool rebase_; // the next pose continues from the current one
+    double x_, y_, yaw_;
+    double offset_x_, offset_y_, offset_yaw_; // continues after a restart
+
+    //consistency window
+    double window_start_; // in s, < 0 if none
+    double host_start_[3], mcu_start_[3];
+    double distance_; // driven by the host in the window
+    double last_host_[2];
+    void startWindow(double x, double y, double yaw, double time);
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _ODOMETRY_COVARIANCE_H_
+#define _ODOMETRY_COVARIANCE_H_
+
+/**
+ * Covariance of the odometry pose (ROS conventions: x, y, yaw), propagated
+ * with every encoder frame.
+ *
+ * Each wheel distance has a variance of wheel_noise^2 per m driven plus the
+ * quantization of one encoder tick, so the covariance grows with the
+ * distance and stays (almost) constant while the robot stands. The pose
+ * covariance is propagated with the jacobians of the differential drive,
+ * the twist covariance is the one of the last frame.
+ */
+class OdometryCovariance
+{
+  public:
+    // wheel_noise in m per sqrt(m), tick_length in m, axis_length in m
+    OdometryCovariance(double wheel_noise, double tick_length, double axis_length,
+        double turning_adaptation);
+
+    void setWheelNoise(double wheel_noise) { wheel_noise_ = wheel_noise; }
+    void setTurningAdaptation(double turning_adaptation) { turning_adaptation_ = turning_adaptation; }
+
+    /**
+     * @param wheel_l distance of the left wheel in m
+     * @param wheel_r distance of the right wheel in m
+     * @param yaw heading before the frame in rad
+     * @param dt length of the frame in s
+     */
+    void update(double wheel_l, double wheel_r, double yaw, double dt);
+
+    // x, y, yaw, row major
+    const double *pose() const { return &pose_[0][0]; }
+    // v, omega, row major
+    const double *twist() const { return &twist_[0][0]; }
+
+  private:
+    double wheel_noise_;
+    double tick_variance_;
+    double axis_length_;
+    double turning_adaptation_;
+
+    double pose_[3][3];
+    double twist_[2][2];
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _ODOMETRY_EKF_H_
+#define _ODOMETRY_EKF_H_
+
+/**
+ * Extended Kalman filter for the planar pose of Kurt (ROS conventions: x
+ * forward, y left, yaw counterclockwise), replaces robot_pose_ekf.
+ *
+ * The state x, y, yaw is predicted with the driven distance and the turn of
+ * every encoder frame and corrected with the drift compensated heading of
+ * the gyro. The wheel noise grows with the driven distance and, much more,
+ * with the turn, as a skid steered robot slips when it turns. The gyro
+ * heading starts wherever the micro controller was switched on, its offset
+ * to the filter heading is taken from the first measurement.
+ */
+class OdometryEKF
+{
+  public:
+    OdometryEKF(double distance_noise, double turn_noise);
+
+    void setParameters(double distance_noise, double turn_noise);
+
+    // distance in m and turn in rad since the last encoder frame
+    void predict(double distance, double turn);
+    // drift compensated gyro heading in rad, its variance in rad^2
+    void updateYaw(double yaw, double variance);
+
+    double x() const { return x_[0]; }
+    double y() const { return x_[1]; }
+    double yaw() const { return x_[2]; }
+    // x, y, yaw, row major
+    const double *covariance() const { return &P_[0][0]; }
+
+  private:
+    double distance_noise_; // stddev in m per m
+    double turn_noise_; // stddev in rad per rad
+
+    double x_[3];
+    double P_[3][3];
+
+    bool yaw_offset_valid_;
+    double yaw_offset_; // filter heading - gyro heading
+};
+
+#endif
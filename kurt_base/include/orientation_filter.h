@@ -0,0 +1,41 @@
+#ifndef _ORIENTATION_FILTER_H_
+#define _ORIENTATION_FILTER_H_
+
+/**
+ * Complementary filter for the 3D orientation of Kurt (ROS conventions:
+ * roll positive right side down, pitch positive nose down).
+ *
+ * Kurt has no roll or pitch rate gyro, but on a slope roll and pitch are
+ * coupled through the heading: turning by dyaw rotates the (roll, pitch)
+ * tilt vector by dyaw. The yaw increments of the gyro predict roll and pitch
+ * this way, the tilt sensor corrects them with time constant tau. Its
+ * angles are only valid when the robot does not accelerate, so the
+ * correction fades out linearly up to max_acceleration.
+ */
+class OrientationFilter
+{
+  public:
+    OrientationFilter(double tau, double max_acceleration);
+
+    void setParameters(double tau, double max_acceleration);
+
+    // tilt sensor angles in rad, acceleration of the robot in m/s^2, dt in s
+    void updateTilt(double roll, double pitch, double acceleration, double dt);
+    // drift compensated heading in rad, dt in s
+    void updateYaw(double yaw, double dt);
+
+    double roll() const { return roll_; }
+    double pitch() const { return pitch_; }
+    double yaw() const { return yaw_; }
+    double yawRate() const { return yaw_rate_; } // in rad/s
+
+  private:
+    double tau_;
+    double max_acceleration_;
+
+    bool tilt_valid_, yaw_valid_;
+    double roll_, pitch_, yaw_;
+    double yaw_rate_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _PWM_TABLE_H_
+#define _PWM_TABLE_H_
+
+#include <vector>
+
+// Monotone piecewise linear inverse of the speedtable (pwm as a function of
+// the wheel speed) with knots at equidistant speeds. The knots of both
+// wheels are interleaved, so one lookup touches a single cache line.
+class PwmTable
+{
+  public:
+    PwmTable() : nr_knots_(0), vmax_(0.0), knots_per_v_(0.0) { }
+
+    // builds nr_v + 1 knots from the measured speeds per pwm (0 .. nr - 1)
+    void build(int nr, const double *v_pwm_l, const double *v_pwm_r, int nr_v);
+
+    // pwm for speed v >= 0 of wheel 0 (left) or 1 (right), interpolated
+    double pwm(double v, int wheel) const
+    {
+      double x = v * knots_per_v_;
+      if (x <= 0.0)
+        return knots_[wheel];
+      if (x >= nr_knots_ - 1)
+        return knots_[2 * (nr_knots_ - 1) + wheel];
+      int i = (int)x;
+      double t = x - i;
+      const double *k = &knots_[2 * i + wheel];
+      return k[0] + t * (k[2] - k[0]);
+    }
+
+    // speed for pwm, inverse of pwm()
+    double speed(double pwm, int wheel) const;
+
+    int size() const { return nr_knots_; }
+    double vmax() const { return vmax_; }
+    // speed of knot i
+    double knotSpeed(int i) const { return i / knots_per_v_; }
+    double &knot(int i, int wheel) { return knots_[2 * i + wheel]; }
+
+    // restores the monotony after changing the knots around knot i
+    void makeMonotone(int i, int wheel);
+
+  private:
+    int nr_knots_;
+    double vmax_;
+    double knots_per_v_;
+    std::vector<double> knots_;
+};
+
+#endif
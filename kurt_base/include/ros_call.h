@@ -0,0 +1,50 @@
+#ifndef _ROS_CALL_H_
+#define _ROS_CALL_H_
+
+#include <boost/shared_ptr.hpp>
+
+#include <ros/ros.h>
+#include <geometry_msgs/Twist.h>
+
+#include "kurt.h"
+#include "velocity_profile.h"
+
+// in s, the robot stops (along the velocity profiles) without a newer cmd_vel
+#define CMD_VEL_TIMEOUT 0.6
+
+// cmd_vel and rot_vel to Kurt, the pid timer sends the wheel speeds
+class ROSCall
+{
+  public:
+    ROSCall(Kurt &kurt, double axis_length) :
+      kurt_(kurt),
+      axis_length_(axis_length),
+      v_l_soll_(0.0),
+      v_r_soll_(0.0),
+      AntiWindup_(1.0),
+      v_soll_(0.0),
+      omega_soll_(0.0),
+      last_cmd_vel_time_(0.0) { }
+    void velCallback(const geometry_msgs::Twist::ConstPtr& msg);
+    void pidCallback(const ros::TimerEvent& event);
+    void rotunitCallback(const geometry_msgs::Twist::ConstPtr& msg);
+
+    void setVelocityProfile(double max_acc_lin, double max_jerk_lin, double max_acc_ang, double max_jerk_ang);
+    // in s, from v m/s and omega rad/s to rest after a cmd_vel timeout, 0 without profiles
+    double stopTime(double v, double omega) const;
+
+  private:
+    Kurt &kurt_;
+    double axis_length_;
+    double v_l_soll_;
+    double v_r_soll_;
+    double AntiWindup_;
+    // cmd_vel for the velocity profiles
+    double v_soll_;
+    double omega_soll_;
+    boost::shared_ptr<VelocityProfile> v_profile_;
+    boost::shared_ptr<VelocityProfile> omega_profile_;
+    ros::Time last_cmd_vel_time_;
+};
+
+#endif
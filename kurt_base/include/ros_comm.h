@@ -0,0 +1,80 @@
+#ifndef _ROS_COMM_H_
+#define _ROS_COMM_H_
+
+#include <string>
+
+#include <ros/ros.h>
+#include <nav_msgs/Odometry.h>
+#include <tf/transform_broadcaster.h>
+
+#include "comm.h"
+
+/**
+ * Publishes what Kurt reports. The sensor streams (odometry, joint states,
+ * ranges, IMU, odom_combined, local grid) are published as shared pointers
+ * to a fresh message each, so subscribers in the same nodelet manager get
+ * them without a copy. A message must not be touched after it is published.
+ */
+class ROSComm : public Comm
+{
+  public:
+    ROSComm(
+        const ros::NodeHandle &n,
+        int ticks_per_turn_of_wheel);
+    virtual void send_odometry(double z, double x, double theta, double
+        v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double
+        v_encoder_left, double v_encoder_right, const double *pose_covariance,
+        const double *twist_covariance);
+    virtual void send_sonar_leftBack(int ir_left_back);
+    virtual void send_sonar_front_usound_leftFront_left(int ir_right_front, int
+        usound, int ir_left_front, int ir_left);
+    virtual void send_sonar_back_rightBack_rightFront(int ir_back, int
+        ir_right_back, int ir_right);
+    virtual void send_imu(double roll, double pitch, double yaw, double yaw_rate,
+        double tilt_variance, double yaw_variance, double stamp);
+    virtual void send_odom_combined(double x, double y, double yaw, const double *covariance,
+        double stamp);
+    virtual void send_slip(double turning_adaptation, double slip_left, double slip_right);
+    virtual void send_mcu_health(const McuHealth &health);
+    virtual void send_odometry_check(double position_error, double yaw_error, bool consistent);
+    virtual void send_local_grid(const LocalGrid &grid, double stamp);
+    virtual void send_rotunit(double rot);
+    virtual void send_bumper(int bumper, int remote_control, bool stopped);
+    virtual void send_watchdog(bool tripped, const char *reason);
+    virtual void send_can_available(bool available);
+
+    void setTFPrefix(const std::string &tf_prefix);
+    // with fused the odom_combined transform comes from the EKF, not from odom
+    void setPublishTF(bool publish_tf, bool fused);
+
+  private:
+    void populateCovariance(nav_msgs::Odometry &msg, const double *pose_covariance,
+        const double *twist_covariance);
+    // range in cm, frame below the tf prefix
+    void send_range(const char *frame, bool ultrasound, int range);
+
+    ros::NodeHandle n_;
+    int ticks_per_turn_of_wheel_;
+    bool publish_tf_;
+    bool fused_tf_;
+    std::string tf_prefix_;
+    double wheelpos_l_, wheelpos_r_; // [rad], -pi..pi
+
+    tf::TransformBroadcaster odom_broadcaster_;
+    ros::Publisher odom_pub_;
+    ros::Publisher range_pub_;
+    ros::Publisher imu_pub_;
+    ros::Publisher odom_combined_pub_;
+    ros::Publisher turning_adaptation_pub_;
+    ros::Publisher slip_pub_;
+    ros::Publisher diagnostics_pub_;
+    ros::Publisher local_grid_pub_;
+    ros::Publisher joint_pub_;
+    ros::Publisher bumper_pub_;
+    ros::Publisher remote_control_pub_;
+    ros::Publisher bumper_stop_pub_;
+    ros::Publisher watchdog_pub_;
+    ros::Publisher can_available_pub_;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _SLIP_ESTIMATOR_H_
+#define _SLIP_ESTIMATOR_H_
+
+/**
+ * Online estimation of the turning adaptation of Kurt from the gyro.
+ *
+ * The heading change of the skid steered robot is modelled per track as
+ * dyaw = (a_r * d_r - a_l * d_l) / axis_length, the encoder distances are
+ * compared with the drift compensated gyro heading over windows of a few
+ * frames and a_l, a_r follow from recursive least squares with exponential
+ * forgetting. Turning on the spot observes a_l + a_r, driving straight
+ * a_r - a_l (one track slips more). The covariance is bounded, so the
+ * estimate does not wind up while only one of them is excited.
+ *
+ * The slip of a track is 1 - a / turning_adaptation, relative to the
+ * configured value for the floor the robot was calibrated on.
+ */
+class SlipEstimator
+{
+  public:
+    SlipEstimator(double turning_adaptation, double forgetting, int window, double min_turn);
+
+    void setParameters(double forgetting, int window, double min_turn);
+
+    // wheel distances of an encoder frame divided by the axis length
+    void addWheels(double turn_l, double turn_r);
+    // drift compensated gyro heading in rad, true if the estimate changed
+    bool addYaw(double yaw);
+    // drop the current window, e.g. after the gyro was rebased
+    void restart() { yaw_valid_ = false; }
+
+    double left() const { return a_[0]; }
+    double right() const { return a_[1]; }
+    double turningAdaptation() const { return 0.5 * (a_[0] + a_[1]); }
+    double slipLeft() const { return 1.0 - a_[0] / nominal_; }
+    double slipRight() const { return 1.0 - a_[1] / nominal_; }
+
+  private:
+    double nominal_;
+    double forgetting_;
+    int window_; // gyro frames
+    double min_turn_; // in rad per window
+
+    double a_[2];
+    double P_[2][2];
+
+    bool yaw_valid_;
+    double window_yaw_;
+    int frames_;
+    double turn_l_, turn_r_;
+};
+
+#endif
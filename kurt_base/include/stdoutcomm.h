@@ -9,7 +9,8 @@ class STDoutComm : public Comm
 {
   public:
     STDoutComm() : sum_ticks_a_(0), sum_ticks_b_(0) { }
-    void send_odometry(double z, double x, double theta, double v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right)
+    void send_odometry(double z, double x, double theta, double v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right,
+        const double *pose_covariance, const double *twist_covariance)
     {
       std::cout << "Odometry: z: " << z << " x: " << x << " theta: " << theta << std::endl;
       std::cout << "Encoder: wheel_a: " << wheel_a  << " wheel_b: " << wheel_b << std::endl;
@@ -42,14 +43,40 @@ class STDoutComm : public Comm
       std::cout << "IR right: " << ir_right << std::endl;
     }
 
-    void send_pitch_roll(double pitch, double roll)
+    void send_imu(double roll, double pitch, double yaw, double yaw_rate,
+        double tilt_variance, double yaw_variance, double stamp)
     {
-      std::cout << "pitch: " << pitch << " roll: " << roll << std::endl;
+      std::cout << "IMU: roll: " << roll << " pitch: " << pitch << " yaw: " << yaw
+        << " yaw rate: " << yaw_rate << " sigma: " << yaw_variance << std::endl;
     }
 
-    void send_gyro(double theta, double sigma)
+    void send_odom_combined(double x, double y, double yaw, const double *covariance, double stamp)
     {
-      std::cout << "Gyro: theta: " << theta << " sigma: " << sigma << std::endl;
+      std::cout << "Odom combined: x: " << x << " y: " << y << " yaw: " << yaw << std::endl;
+    }
+
+    void send_slip(double turning_adaptation, double slip_left, double slip_right)
+    {
+      std::cout << "Slip: turning adaptation: " << turning_adaptation << " left: " << slip_left
+        << " right: " << slip_right << std::endl;
+    }
+
+    void send_mcu_health(const McuHealth &health)
+    {
+      std::cout << "MCU: " << health.message << " cycle: " << health.cycle_time
+        << " current left: " << health.current_left << " right: " << health.current_right
+        << " temperature: " << health.temperature << std::endl;
+    }
+
+    void send_odometry_check(double position_error, double yaw_error, bool consistent)
+    {
+      std::cout << "Odometry check: position error: " << position_error << " yaw error: " << yaw_error
+        << " consistent: " << consistent << std::endl;
+    }
+
+    void send_local_grid(const LocalGrid &grid, double stamp)
+    {
+      std::cout << "Local grid: origin: " << grid.originX() << " " << grid.originY() << std::endl;
     }
 
     void send_rotunit(double rot)
@@ -57,6 +84,21 @@ class STDoutComm : public Comm
       std::cout << "Rotunit" << rot <<  std::endl;
     }
 
+    void send_bumper(int bumper, int remote_control, bool stopped)
+    {
+      std::cout << "Bumper: " << bumper << " remote control: " << remote_control << " stopped: " << stopped << std::endl;
+    }
+
+    void send_watchdog(bool tripped, const char *reason)
+    {
+      std::cout << "Watchdog: tripped: " << tripped << " reason: " << reason << std::endl;
+    }
+
+    void send_can_available(bool available)
+    {
+      std::cout << "CAN available: " << available << std::endl;
+    }
+
     unsigned long long K_get_sum_ticks_a()
     {
       return sum_ticks_a_;
@@ -0,0 +1,93 @@
+#ifndef _VELOCITY_FILTER_H_
+#define _VELOCITY_FILTER_H_
+
+#include <string>
+#include <vector>
+
+// smoothing of the encoder velocities for the host side PI controller
+class VelocityFilter
+{
+  public:
+    virtual ~VelocityFilter() { }
+    // adds a measurement and returns the filtered velocity
+    virtual double filter(double v) = 0;
+    virtual void reset() = 0;
+
+    // type: moving_average, median, ema or kalman; NULL for unknown types
+    static VelocityFilter *create(const std::string &type, int window, double alpha,
+        double process_noise, double measurement_noise, double dt);
+};
+
+// fixed size ring buffer, starts filled with zeros
+class RingBuffer
+{
+  public:
+    RingBuffer(int size) : values_(size > 0 ? size : 1, 0.0), next_(0) { }
+    // returns the value that was overwritten
+    double push(double v)
+    {
+      double old = values_[next_];
+      values_[next_] = v;
+      next_ = (next_ + 1) % values_.size();
+      return old;
+    }
+    void clear() { values_.assign(values_.size(), 0.0); next_ = 0; }
+    int size() const { return values_.size(); }
+
+  private:
+    std::vector<double> values_;
+    size_t next_;
+};
+
+class MovingAverageFilter : public VelocityFilter
+{
+  public:
+    MovingAverageFilter(int window) : buffer_(window), sum_(0.0) { }
+    double filter(double v);
+    void reset();
+
+  private:
+    RingBuffer buffer_;
+    double sum_;
+};
+
+class MedianFilter : public VelocityFilter
+{
+  public:
+    MedianFilter(int window) : buffer_(window), sorted_(buffer_.size(), 0.0) { }
+    double filter(double v);
+    void reset();
+
+  private:
+    RingBuffer buffer_;
+    std::vector<double> sorted_; // window contents in ascending order
+};
+
+class EMAFilter : public VelocityFilter
+{
+  public:
+    EMAFilter(double alpha) : alpha_(alpha), v_(0.0) { }
+    double filter(double v);
+    void reset();
+
+  private:
+    double alpha_;
+    double v_;
+};
+
+// constant velocity Kalman filter with state (v, a)
+class KalmanFilter : public VelocityFilter
+{
+  public:
+    KalmanFilter(double process_noise, double measurement_noise, double dt) :
+      q_(process_noise), r_(measurement_noise), dt_(dt) { reset(); }
+    double filter(double v);
+    void reset();
+
+  private:
+    double q_, r_, dt_;
+    double v_, a_;
+    double p_vv_, p_va_, p_aa_; // covariance
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _VELOCITY_PROFILE_H_
+#define _VELOCITY_PROFILE_H_
+
+// acceleration and jerk limited tracking of a velocity setpoint
+class VelocityProfile
+{
+  public:
+    VelocityProfile(double max_acc, double max_jerk) :
+      max_acc_(max_acc),
+      max_jerk_(max_jerk),
+      v_(0.0),
+      a_(0.0) { }
+
+    // advances the profile by dt towards target and returns the new velocity
+    double update(double target, double dt);
+    void reset(double v = 0.0);
+
+    double velocity() const { return v_; }
+    double acceleration() const { return a_; }
+    bool atRest() const { return v_ == 0.0 && a_ == 0.0; }
+    // time in s to ramp down from velocity v at zero acceleration
+    double stopTime(double v) const;
+
+  private:
+    double max_acc_;
+    double max_jerk_;
+    double v_;
+    double a_;
+};
+
+#endif
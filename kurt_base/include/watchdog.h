@@ -0,0 +1,58 @@
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * Supervises the driver from its own thread, independent of the ROS spin
+ * loop and of a blocking CAN read:
+ *
+ * - command age: a moving command older than command_timeout
+ * - CAN RX liveness: no frame from the micro controller for rx_timeout
+ * - control deadline: no control cycle for control_deadline (only after the
+ *   first cycle)
+ *
+ * The checks run every period on an absolute monotonic schedule, so a
+ * violation is detected at most timeout + period after the last event. The
+ * trip callback is called once per trip with the first violated check, the
+ * release callback once all checks pass again. Timeouts <= 0 disable a check.
+ */
+class Watchdog
+{
+  public:
+    enum Reason
+    {
+      NONE,
+      COMMAND_TIMEOUT,
+      CAN_RX_TIMEOUT,
+      CONTROL_DEADLINE
+    };
+
+    Watchdog(double command_timeout, double rx_timeout, double control_deadline, double period,
+        const boost::function<void (Reason)> &trip, const boost::function<void ()> &release);
+    ~Watchdog();
+
+    // thread safe, called by the monitored paths
+    void commandReceived(bool moving);
+    void frameReceived();
+    void controlCycle();
+
+    static const char *reasonString(Reason reason);
+
+  private:
+    void run();
+    Reason check(double now);
+
+    double command_timeout_, rx_timeout_, control_deadline_, period_;
+    boost::function<void (Reason)> trip_;
+    boost::function<void ()> release_;
+
+    boost::mutex mutex_;
+    double last_command_, last_frame_, last_cycle_; // monotonic s, last_cycle_ < 0 until the first cycle
+    bool moving_;
+    bool stop_;
+    boost::thread thread_;
+};
+
+#endif
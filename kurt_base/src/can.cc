@@ -1,19 +1,52 @@
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <ctime>
 #include <unistd.h>
 
+#include <sys/select.h>
+#include <sys/socket.h>
+
 #include <net/if.h>
 #include <sys/ioctl.h>
 
+#include <linux/can/error.h>
+#include <linux/sockios.h>
 #include <linux/can/raw.h>
 
-#include <ros/console.h>
-
 #include "can.h"
+#include "kurt_clock.h"
+#include "kurt_log.h"
+
+CAN::CAN() :
+  cansocket_(-1),
+  link_lost_(false),
+  backoff_(CAN_BACKOFF_MIN),
+  next_connect_(0.0),
+  stamp_(0.0)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!connect())
+    KURT_ERROR("can_init: Retrying in the background");
+}
 
-CAN::CAN()
+CAN::~CAN()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  disconnect();
+}
+
+bool CAN::connected() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return cansocket_ >= 0;
+}
+
+// connect and disconnect are called with the mutex held
+
+bool CAN::connect()
 {
   sockaddr_can addr;
   ifreq ifr;
@@ -21,39 +54,87 @@ CAN::CAN()
 
   cansocket_ = socket(PF_CAN, SOCK_RAW, CAN_RAW);
   if (cansocket_ < 0) {
-    ROS_ERROR("can_init: Error opening socket (%s)", strerror(errno));
-    exit(1);
+    KURT_ERROR("can_init: Error opening socket (%s)", strerror(errno));
+    disconnect();
+    return false;
   }
 
   addr.can_family = AF_CAN;
 
   strcpy(ifr.ifr_name, caninterface);
   if (ioctl(cansocket_, SIOCGIFINDEX, &ifr) < 0) {
-    ROS_ERROR("can_init: Error setting SIOCGIFINDEX for interace %s (%s)", caninterface, strerror(errno));
-    exit(1);
+    KURT_ERROR("can_init: Error setting SIOCGIFINDEX for interace %s (%s)", caninterface, strerror(errno));
+    disconnect();
+    return false;
   }
 
   addr.can_ifindex = ifr.ifr_ifindex;
 
+  // report bus off and controller problems as error frames
+  can_err_mask_t err_mask = CAN_ERR_BUSOFF | CAN_ERR_CRTL | CAN_ERR_RESTARTED;
+  if (setsockopt(cansocket_, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) < 0) {
+    KURT_ERROR("can_init: Error setting the error filter (%s)", strerror(errno));
+    disconnect();
+    return false;
+  }
+
   if (bind(cansocket_, (sockaddr *)&addr, sizeof(addr)) < 0) {
-    ROS_ERROR("can_init: Error binding socket (%s)", strerror(errno));
-    exit(1);
+    KURT_ERROR("can_init: Error binding socket (%s)", strerror(errno));
+    disconnect();
+    return false;
   }
 
-  ROS_INFO("CAN interface init done");
+  backoff_ = CAN_BACKOFF_MIN;
+  link_lost_ = false;
+  KURT_INFO("CAN interface init done");
+  return true;
 }
 
-CAN::~CAN()
+// closes the socket, the next connect is due after the backoff
+void CAN::disconnect()
 {
+  next_connect_ = monotonic_seconds() + backoff_;
+  backoff_ = std::min(2.0 * backoff_, CAN_BACKOFF_MAX);
+  if (cansocket_ < 0)
+    return;
   if (close(cansocket_) != 0)
-    ROS_ERROR("can_close: Error closing can socket (%s)", strerror(errno));
+    KURT_ERROR("can_close: Error closing can socket (%s)", strerror(errno));
+  cansocket_ = -1;
+}
+
+// errors after which only a new socket helps
+bool CAN::link_lost(int error) const
+{
+  return error == ENETDOWN || error == ENODEV || error == ENXIO || error == EBADF;
 }
 
 bool CAN::send_frame(const can_frame *frame)
 {
-  if (write(cansocket_, frame, sizeof(*frame)) != sizeof(*frame))
+  boost::mutex::scoped_lock lock(mutex_);
+  if (cansocket_ < 0 || link_lost_)
+    return false;
+
+  fd_set wfds;
+
+  FD_ZERO(&wfds);
+  FD_SET(cansocket_, &wfds);
+
+  timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = CAN_SEND_TIMEOUT * 1000;
+
+  int rc = select(cansocket_ + 1, NULL, &wfds, NULL, &timeout);
+  if (rc <= 0)
+  {
+    KURT_ERROR("send_frame: Socket not writable (%s)", rc == 0 ? "timed out" : strerror(errno));
+    return false;
+  }
+
+  if (send(cansocket_, frame, sizeof(*frame), MSG_DONTWAIT) != sizeof(*frame))
   {
-    ROS_ERROR("send_frame: Error writing socket (%s)", strerror(errno));
+    KURT_ERROR("send_frame: Error writing socket (%s)", strerror(errno));
+    if (link_lost(errno))
+      link_lost_ = true;
     return false;
   }
   return true;
@@ -61,34 +142,89 @@ bool CAN::send_frame(const can_frame *frame)
 
 bool CAN::receive_frame(can_frame *frame)
 {
+  // only this thread closes the socket, so it stays valid without the lock
+  int cansocket;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (link_lost_)
+    {
+      KURT_ERROR("receive_frame: Link lost while sending, reconnecting");
+      disconnect();
+      link_lost_ = false;
+    }
+    if (cansocket_ < 0)
+    {
+      double wait = next_connect_ - monotonic_seconds();
+      if (wait > 0.0)
+      {
+        lock.unlock();
+        usleep((useconds_t)(std::min(wait, CAN_BACKOFF_MIN) * 1e6));
+        return false;
+      }
+      if (!connect())
+        return false;
+    }
+    cansocket = cansocket_;
+  }
+
   fd_set rfds;
 
   FD_ZERO(&rfds);
-  FD_SET(cansocket_, &rfds);
+  FD_SET(cansocket, &rfds);
 
   int rc = 1;
   timeval timeout;
 
-  timeout.tv_sec = 5;
+  timeout.tv_sec = CAN_RECEIVE_TIMEOUT;
   timeout.tv_usec = 0;
 
-  rc = select(cansocket_ + 1, &rfds, NULL, NULL, &timeout);
+  rc = select(cansocket + 1, &rfds, NULL, NULL, &timeout);
 
   if (rc == 0)
   {
-    ROS_ERROR("recive_frame: Receiving frame timed out (Kurt switched off?)");
+    KURT_ERROR_THROTTLE(10, "recive_frame: Receiving frame timed out (Kurt switched off?)");
     return false;
   }
   else if (rc == -1)
   {
-    ROS_WARN("recive_frame: Error receiving frame (%s)", strerror(errno));
+    KURT_WARN("recive_frame: Error receiving frame (%s)", strerror(errno));
     return false;
   }
 
-  //TODO read time stamp
-  if (read(cansocket_, frame, sizeof(*frame)) != sizeof(*frame))
+  if (read(cansocket, frame, sizeof(*frame)) != sizeof(*frame))
+  {
+    KURT_WARN("receive_frame: Error reading socket (%s)", strerror(errno));
+    if (link_lost(errno))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      disconnect();
+    }
+    return false;
+  }
+
+  // kernel reception time
+  timeval tv;
+  if (ioctl(cansocket, SIOCGSTAMP, &tv) == 0)
+    stamp_ = tv.tv_sec + tv.tv_usec * 1e-6;
+  else
+    stamp_ = 0.0;
+
+  if (frame->can_id & CAN_ERR_FLAG)
   {
-    ROS_WARN("receive_frame: Error reading socket (%s)", strerror(errno));
+    if (frame->can_id & CAN_ERR_BUSOFF)
+    {
+      KURT_ERROR("receive_frame: Bus off, reconnecting");
+      boost::mutex::scoped_lock lock(mutex_);
+      disconnect();
+    }
+    else if (frame->can_id & CAN_ERR_RESTARTED)
+    {
+      KURT_INFO("receive_frame: Controller restarted");
+    }
+    else
+    {
+      KURT_WARN("receive_frame: Controller error %02X", frame->data[1]);
+    }
     return false;
   }
   return true;
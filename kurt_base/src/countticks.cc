@@ -43,7 +43,8 @@ int main(int argc, char **argv)
   int ticks_per_turn_of_wheel = 21950;
 
   STDoutComm stdoutcomm;
-  Kurt kurt(stdoutcomm, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
+  CAN can;
+  Kurt kurt(stdoutcomm, can, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
 
   Get_mtime_diff(2);
   Get_mtime_diff(3);
@@ -74,7 +75,7 @@ int main(int argc, char **argv)
         stdoutcomm.K_get_sum_ticks_b());
 
     // xx umdrehungen pro rad zaehlen
-    if (abs(stdoutcomm.K_get_sum_ticks_a()) > nr_ticks*nr_turns-200) {
+    if (llabs((long long)stdoutcomm.K_get_sum_ticks_a()) > nr_ticks*nr_turns-200) {
       Time_Diffa += Get_mtime_diff(2);
       if ( i > 0) {
         i = 0;
@@ -90,7 +91,7 @@ int main(int argc, char **argv)
     // fuer kurt2 mit 90 watt motoren und 1:14 getriebe
     // encoder 500 oder 1000 / umdrehung
     // umsetzung kette ??
-    if (abs(stdoutcomm.K_get_sum_ticks_b()) > nr_ticks*nr_turns-200) {
+    if (llabs((long long)stdoutcomm.K_get_sum_ticks_b()) > nr_ticks*nr_turns-200) {
       Time_Diffb += Get_mtime_diff(4);
       if (j > 0) {
         j = 0;
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "kurt.h"
+#include "kurt_sim.h"
+
+// Sweeps kp x ki x feedforward_turn of the host PI controller against the
+// simulated drive (kurt_sim.h) and reports the step response of every
+// combination, one simulation per core at a time.
+
+//Odometry parameter (defaults for kurt2 indoor)
+static const double wheel_perimeter = 0.379;
+static const double axis_length = 0.28;
+static const double turning_adaptation = 0.69;
+static const int ticks_per_turn_of_wheel = 21950;
+
+struct Trial
+{
+  double kp, ki, feedforward_turn;
+  StepResponse left, right;
+  bool ok;
+};
+
+struct Sweep
+{
+  std::string speedtable;
+  double v, omega; // step of cmd_vel
+  double duration; // in s
+  double tau, load, encoder_noise;
+
+  std::vector<Trial> trials;
+  size_t next;
+  boost::mutex mutex;
+};
+
+static void run_trial(const Sweep &sweep, Trial &trial, unsigned int seed)
+{
+  KurtSimulator sim(wheel_perimeter, ticks_per_turn_of_wheel, sweep.tau, sweep.load, sweep.encoder_noise, seed);
+  NullComm comm;
+  Kurt kurt(comm, sim, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
+  kurt.setClock(sim);
+  trial.ok = sim.loadSpeedtable(sweep.speedtable) &&
+    kurt.setPWMData(sweep.speedtable, trial.feedforward_turn, trial.ki, trial.kp);
+  if (!trial.ok)
+    return;
+
+  // as ROSCall::velCallback
+  double v_l_soll = sweep.v - axis_length * sweep.omega;
+  double v_r_soll = sweep.v + axis_length * sweep.omega;
+
+  int steps = (int)(sweep.duration / 0.01);
+  std::vector<double> v_l(steps), v_r(steps);
+  for (int i = 0; i < steps; i++)
+  {
+    kurt.set_wheel_speed(v_l_soll, v_r_soll, sweep.omega, 1.0);
+    kurt.can_read_fifo();
+    v_l[i] = sim.speed(0);
+    v_r[i] = sim.speed(1);
+  }
+  trial.left = StepResponse::evaluate(v_l, v_l_soll, 0.01);
+  trial.right = StepResponse::evaluate(v_r, v_r_soll, 0.01);
+}
+
+static void worker(Sweep *sweep)
+{
+  while (true)
+  {
+    size_t i;
+    {
+      boost::mutex::scoped_lock lock(sweep->mutex);
+      if (sweep->next >= sweep->trials.size())
+        return;
+      i = sweep->next++;
+    }
+    // same noise for every trial, the gains are the only difference
+    run_trial(*sweep, sweep->trials[i], 1);
+  }
+}
+
+static std::vector<double> grid(double min, double max, int steps)
+{
+  std::vector<double> values;
+  for (int i = 0; i < steps; i++)
+    values.push_back(steps > 1 ? min + (max - min) * i / (steps - 1) : min);
+  return values;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 10)
+  {
+    fprintf(stderr, "usage: %s <speedtable> <v> <omega> <kp_min> <kp_max> <kp_steps> <ki_min> <ki_max> <ki_steps>"
+        " [<ff_min> <ff_max> <ff_steps> [<tau> [<load> [<encoder_noise> [<threads>]]]]]\n", argv[0]);
+    return 1;
+  }
+
+  Sweep sweep;
+  sweep.speedtable = argv[1];
+  sweep.v = atof(argv[2]);
+  sweep.omega = atof(argv[3]);
+  sweep.duration = 3.0;
+  sweep.tau = argc > 13 ? atof(argv[13]) : 0.1;
+  sweep.load = argc > 14 ? atof(argv[14]) : 1.0;
+  sweep.encoder_noise = argc > 15 ? atof(argv[15]) : 0.0;
+  int threads = argc > 16 ? atoi(argv[16]) : 0;
+  if (threads <= 0)
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+
+  std::vector<double> kps = grid(atof(argv[4]), atof(argv[5]), atoi(argv[6]));
+  std::vector<double> kis = grid(atof(argv[7]), atof(argv[8]), atoi(argv[9]));
+  std::vector<double> ffs = argc > 12 ? grid(atof(argv[10]), atof(argv[11]), atoi(argv[12])) : grid(0.35, 0.35, 1);
+  for (size_t a = 0; a < kps.size(); a++)
+    for (size_t b = 0; b < kis.size(); b++)
+      for (size_t c = 0; c < ffs.size(); c++)
+      {
+        Trial trial;
+        trial.kp = kps[a];
+        trial.ki = kis[b];
+        trial.feedforward_turn = ffs[c];
+        trial.ok = false;
+        sweep.trials.push_back(trial);
+      }
+  if (sweep.trials.empty())
+  {
+    fprintf(stderr, "Empty gain grid\n");
+    return 1;
+  }
+  sweep.next = 0;
+
+  boost::thread_group workers;
+  for (int t = 0; t < threads; t++)
+    workers.create_thread(boost::bind(&worker, &sweep));
+  workers.join_all();
+
+  printf("# kp ki feedforward_turn | rise_time[s] overshoot steady_state_error[m/s] iae[m] (left, right)\n");
+  int best = -1;
+  double best_iae = 0.0;
+  for (size_t i = 0; i < sweep.trials.size(); i++)
+  {
+    const Trial &t = sweep.trials[i];
+    if (!t.ok)
+      return 1;
+    printf("%lf %lf %lf | %lf %lf %lf %lf | %lf %lf %lf %lf\n", t.kp, t.ki, t.feedforward_turn,
+        t.left.rise_time, t.left.overshoot, t.left.steady_state_error, t.left.iae,
+        t.right.rise_time, t.right.overshoot, t.right.steady_state_error, t.right.iae);
+    double iae = t.left.iae + t.right.iae;
+    if (best < 0 || iae < best_iae)
+    {
+      best = i;
+      best_iae = iae;
+    }
+  }
+  printf("# best (lowest iae): kp %lf ki %lf feedforward_turn %lf\n",
+      sweep.trials[best].kp, sweep.trials[best].ki, sweep.trials[best].feedforward_turn);
+  return 0;
+}
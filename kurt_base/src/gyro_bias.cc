@@ -0,0 +1,52 @@
+#include <algorithm>
+#include <cmath>
+
+#include "gyro_bias.h"
+
+static double normalize(double angle)
+{
+  return remainder(angle, 2.0 * M_PI);
+}
+
+GyroBiasEstimator::GyroBiasEstimator(double max_delta, int window) :
+  max_delta_(max_delta),
+  window_(window > 0 ? window : 1),
+  first_(true),
+  samples_(0),
+  bias_(0.0),
+  error_(0.0),
+  last_theta_(0.0),
+  yaw_(0.0) { }
+
+void GyroBiasEstimator::setParameters(double max_delta, int window)
+{
+  max_delta_ = max_delta;
+  window_ = window > 0 ? window : 1;
+  samples_ = std::min(samples_, window_);
+}
+
+double GyroBiasEstimator::update(double theta, bool standing)
+{
+  if (first_)
+  {
+    // start at 0 (or continue from the last corrected heading)
+    error_ = normalize(theta - yaw_);
+    last_theta_ = theta;
+    first_ = false;
+    return yaw_;
+  }
+
+  double delta = normalize(theta - last_theta_);
+  last_theta_ = theta;
+
+  if (standing && fabs(delta) < max_delta_)
+  {
+    if (samples_ < window_)
+      samples_++;
+    bias_ += (delta - bias_) / samples_;
+  }
+
+  error_ = normalize(error_ + bias_);
+  yaw_ = normalize(theta - error_);
+  return yaw_;
+}
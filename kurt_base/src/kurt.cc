@@ -1,25 +1,40 @@
-#include <ros/console.h>
-
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <ctime>
 
+#include <stdint.h>
+#include <unistd.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <linux/can.h>
 
+#include <boost/bind.hpp>
+
 #include "comm.h"
 #include "kurt.h"
+#include "kurt_log.h"
 
 Kurt::~Kurt()
 {
+  watchdog_.reset();
   if(use_rotunit_)
     can_rotunit_send(0.0);
   k_hard_stop();
   if(!use_microcontroller_)
   {
-    free(pwm_v_l_);
-    free(pwm_v_r_);
+    if (learn_feedforward_ && learn_dirty_)
+      save_learned_table();
+  }
+  if (learn_writer_.joinable())
+  {
+    {
+      boost::mutex::scoped_lock lock(learn_mutex_);
+      learn_stop_ = true;
+    }
+    learn_cond_.notify_one();
+    // writes the pending table before stopping
+    learn_writer_.join();
   }
 }
 
@@ -27,6 +42,7 @@ bool Kurt::setPWMData(const std::string &speedPwmLeerlaufTable, double feedforwa
 {
   ki_l = ki_r = ki;
   kp_l = kp_r = kp;
+  feedforward_turn_ = feedforward_turn;
 
   int nr;
   double *v_pwm_l, *v_pwm_r;
@@ -34,7 +50,11 @@ bool Kurt::setPWMData(const std::string &speedPwmLeerlaufTable, double feedforwa
   {
     return false;
   }
-  make_pwm_v_tab(nr, v_pwm_l, v_pwm_r, nr_v_, &pwm_v_l_, &pwm_v_r_, &vmax_);
+  // generate reverse speedtable
+  pwm_v_.build(nr, v_pwm_l, v_pwm_r, nr_v_);
+  vmax_ = pwm_v_.vmax();
+  v_pwm_l_.assign(v_pwm_l, v_pwm_l + nr);
+  v_pwm_r_.assign(v_pwm_r, v_pwm_r + nr);
   free(v_pwm_l);
   free(v_pwm_r);
   use_microcontroller_ = false;
@@ -42,6 +62,134 @@ bool Kurt::setPWMData(const std::string &speedPwmLeerlaufTable, double feedforwa
   return true;
 }
 
+void Kurt::setBumperStop(int bumper_mask, int remote_control_mask)
+{
+  bumper_mask_ = bumper_mask;
+  remote_control_mask_ = remote_control_mask;
+}
+
+void Kurt::setGyroBiasEstimation(double max_drift, double time_constant)
+{
+  // the gyro frames arrive every 10 ms
+  gyro_bias_.setParameters(max_drift * 0.01, (int)(time_constant / 0.01));
+}
+
+void Kurt::setOrientationFilter(double tau, double max_acceleration, double tilt_stddev)
+{
+  orientation_.setParameters(tau, max_acceleration);
+  tilt_variance_ = tilt_stddev * tilt_stddev;
+}
+
+void Kurt::setOdometryEKF(double distance_noise, double turn_noise, double gyro_stddev)
+{
+  ekf_.reset(new OdometryEKF(distance_noise, turn_noise));
+  ekf_gyro_variance_ = gyro_stddev * gyro_stddev;
+}
+
+void Kurt::setSlipEstimation(double forgetting, double window, double min_turn)
+{
+  // the gyro frames arrive every 10 ms
+  slip_.reset(new SlipEstimator(turning_adaptation_, forgetting, (int)(window / 0.01), min_turn));
+}
+
+void Kurt::setMcuMonitor(double period, double max_current, double max_temperature,
+    double cycle_tolerance, double voltage)
+{
+  mcu_.setParameters(period, max_current, max_temperature, cycle_tolerance, voltage);
+}
+
+void Kurt::setLocalGrid(double resolution, double publish_period)
+{
+  grid_.reset(new LocalGrid(resolution));
+  // the encoder frames arrive every 10 ms
+  grid_publish_cycles_ = std::max(1, (int)(publish_period / 0.01));
+}
+
+void Kurt::setOdometrySource(OdometrySource source, double check_period, double max_error,
+    double max_relative_error, double max_yaw_error)
+{
+  odometry_source_ = source;
+  mcu_odometry_.setParameters(check_period, max_error, max_relative_error, max_yaw_error);
+}
+
+void Kurt::startWatchdog(double command_timeout, double rx_timeout, double control_deadline, double period)
+{
+  watchdog_.reset(new Watchdog(command_timeout, rx_timeout, control_deadline, period,
+        boost::bind(&Kurt::emergencyStop, this, _1), boost::bind(&Kurt::releaseEmergencyStop, this)));
+}
+
+void Kurt::commandReceived(bool moving)
+{
+  if (watchdog_)
+    watchdog_->commandReceived(moving);
+}
+
+// watchdog thread
+void Kurt::emergencyStop(Watchdog::Reason reason)
+{
+  KURT_ERROR("Watchdog: %s, stopping", Watchdog::reasonString(reason));
+  {
+    boost::mutex::scoped_lock lock(motor_mutex_);
+    emergency_stop_ = true;
+  }
+  k_hard_stop();
+  comm_.send_watchdog(true, Watchdog::reasonString(reason));
+}
+
+// watchdog thread
+void Kurt::releaseEmergencyStop()
+{
+  KURT_INFO("Watchdog: released");
+  {
+    boost::mutex::scoped_lock lock(motor_mutex_);
+    emergency_stop_ = false;
+    resume_ = true;
+  }
+  comm_.send_watchdog(false, Watchdog::reasonString(Watchdog::NONE));
+}
+
+bool Kurt::setGainTable(const std::string &gainTable)
+{
+  return read_gain_table(gainTable, gain_table_);
+}
+
+void Kurt::setFeedforwardLearning(const std::string &learnedTable, double rate, double max_step,
+    int width, double save_period)
+{
+  learn_feedforward_ = true;
+  learned_table_file_ = learnedTable;
+  learn_rate_ = rate;
+  learn_max_step_ = max_step;
+  learn_width_ = std::max(0, width);
+  // the PI controller runs every 10 ms
+  learn_save_cycles_ = std::max(1, (int)(save_period / 0.01));
+  learn_cycle_ = 0;
+  learn_dirty_ = false;
+  learn_steady_[0] = learn_steady_[1] = 0;
+  learn_v_soll_[0] = learn_v_soll_[1] = 0.0;
+  if (!learn_writer_.joinable())
+    learn_writer_ = boost::thread(boost::bind(&Kurt::run_learn_writer, this));
+}
+
+bool Kurt::setVelocityFilter(const std::string &type, int window, double alpha,
+    double process_noise, double measurement_noise, double max_jump)
+{
+  // the PI controller runs every 10 ms
+  VelocityFilter *filter_l = VelocityFilter::create(type, window, alpha, process_noise, measurement_noise, 0.01);
+  VelocityFilter *filter_r = VelocityFilter::create(type, window, alpha, process_noise, measurement_noise, 0.01);
+  if (filter_l == NULL || filter_r == NULL)
+  {
+    KURT_ERROR("Unknown velocity filter: %s", type.c_str());
+    delete filter_l;
+    delete filter_r;
+    return false;
+  }
+  v_filter_l_.reset(filter_l);
+  v_filter_r_.reset(filter_r);
+  max_v_jump_ = max_jump;
+  return true;
+}
+
 int Kurt::can_motor(int left_pwm,  char left_dir,  char left_brake,
     int right_pwm, char right_dir, char right_brake)
 {
@@ -60,14 +208,24 @@ int Kurt::can_motor(int left_pwm,  char left_dir,  char left_brake,
   frame.data[6] = (right_pwm >> 8);
   frame.data[7] = (right_pwm);
 
-  if (!can_.send_frame(&frame))
+  if (!send_motor_frame(frame, left_brake && right_brake))
   {
-    ROS_ERROR("can_motor: Error sending PWM data");
+    KURT_ERROR("can_motor: Error sending PWM data");
     return 1;
   }
   return 0;
 }
 
+// while the watchdog holds the robot only brake frames go out, the lock
+// orders them against a concurrent emergency stop
+bool Kurt::send_motor_frame(const can_frame &frame, bool brake)
+{
+  boost::mutex::scoped_lock lock(motor_mutex_);
+  if (emergency_stop_ && !brake)
+    return true;
+  return can_.send_frame(&frame);
+}
+
 void Kurt::k_hard_stop(void)
 {
   unsigned short pwm_left, pwm_right;
@@ -79,9 +237,14 @@ void Kurt::k_hard_stop(void)
   dir_right = 0;
   brake_right = 1;
 
-  do
-  { }
-  while (!can_motor(pwm_left, dir_left, brake_left, pwm_right, dir_right, brake_right));
+  // bounded: every send gives up after CAN_SEND_TIMEOUT, so the stop takes
+  // at most HARD_STOP_TRIES * CAN_SEND_TIMEOUT
+  for (int tries = 0; tries < HARD_STOP_TRIES; tries++)
+  {
+    if (can_motor(pwm_left, dir_left, brake_left, pwm_right, dir_right, brake_right) == 0)
+      return;
+  }
+  KURT_ERROR("k_hard_stop: Brake frame not sent after %d tries", HARD_STOP_TRIES);
 }
 
 // PWM Lookup
@@ -93,22 +256,14 @@ void Kurt::set_wheel_speed1(double v_l, double v_r, int integration_l, int integ
   unsigned short pwm_left, pwm_right;
   unsigned char dir_left, dir_right, brake_left, brake_right;
 
-  int index_l, index_r; // point in speed_pwm tabelle
-
-  // calc pwm values form speed array
-  index_l = (int)(fabs(v_l) / vmax_ * nr_v_);
-  index_r = (int)(fabs(v_r) / vmax_ * nr_v_);
-
-  index_l = std::min(nr_v_ - 1, index_l);
-  index_r = std::min(nr_v_ - 1, index_r);
-
+  // calc pwm values from the interpolated speed table
   // 1023 = zero, 0 = maxspeed
   if (fabs(v_l) > 0.01)
-    pwm_left = std::max(0, std::min(1023, 1024 - pwm_v_l_[index_l] - leerlauf_adapt_ - integration_l));
+    pwm_left = std::max(0, std::min(1023, (int)(1024.5 - pwm_v_.pwm(fabs(v_l), 0)) - leerlauf_adapt_ - integration_l));
   else
     pwm_left = 1023;
   if (fabs(v_r) > 0.01)
-    pwm_right = std::max(0, std::min(1023, 1024 - pwm_v_r_[index_r] - leerlauf_adapt_ - integration_r));
+    pwm_right = std::max(0, std::min(1023, (int)(1024.5 - pwm_v_.pwm(fabs(v_r), 1)) - leerlauf_adapt_ - integration_r));
   else
     pwm_right = 1023;
 
@@ -134,112 +289,89 @@ void Kurt::set_wheel_speed1(double v_l, double v_r, int integration_l, int integ
 void Kurt::set_wheel_speed2(double _v_l_soll, double _v_r_soll, double _v_l_ist,
     double _v_r_ist, double _omega, double _AntiWindup)
 {
-  // stellgroessen v=speed, l= links, r= rechts
-  static double zl = 0.0, zr = 0.0;
-  static double last_zl = 0.0, last_zr = 0.0;
-  // regelabweichung e = soll - ist;
-  static double el = 0.0, er = 0.0;
-  static double last_el = 0.0, last_er = 0.0;
-  // integral
-  static double int_el = 0.0, int_er = 0.0;
+  // stellgroessen v=speed, l= links, r= rechts: zl_, zr_
+  // regelabweichung e = soll - ist: el_, er_
   // differenzieren
-  static double del = 0.0, der = 0.0;
+  double del = 0.0, der = 0.0;
   // zeitinterval
   double dt = 0.01;
-  // filter fuer gueltige Werte
-  static double last_v_l_ist = 0.0, last_v_r_ist = 0.0;
-  // static int reached = 0;
-
-  // These arrays need to be initialized because we read from indices 0, 1, 2
-  // before writing to them. If an array is partially initialized, elements
-  // that are not initialized receive the value 0 of the appropriate type, so
-  // initializing the first value is enough.
-  static double v_l_list[MAX_V_LIST] = {0.0}, v_r_list[MAX_V_LIST] = {0.0};
-  static int vl_index = 3, vr_index = 3;
-  int i;
-  static double f_v_l_ist, f_v_r_ist;
+
+  double f_v_l_ist, f_v_r_ist;
   // kd_l and kd_r allways 0 (using only pi controller here)
   double kd_l = 0.0, kd_r = 0.0; // nur pi regler d-anteil ausblenden
 
-  int_el *= _AntiWindup;
-  int_er *= _AntiWindup;
+  int_el_ *= _AntiWindup;
+  int_er_ *= _AntiWindup;
 
-  last_v_l_ist *= _AntiWindup;
-  last_v_r_ist *= _AntiWindup;
+  last_v_l_ist_ *= _AntiWindup;
+  last_v_r_ist_ *= _AntiWindup;
+  // the filters start over once with the integrators (zero command, resume
+  // after a watchdog stop or a reconnect), not on every cycle of a stop
+  if (_AntiWindup == 0.0 && last_anti_windup_ != 0.0)
+  {
+    v_filter_l_->reset();
+    v_filter_r_->reset();
+  }
+  last_anti_windup_ = _AntiWindup;
 
   double turn_feedforward_l = -_omega / M_PI * feedforward_turn_;
   double turn_feedforward_r = _omega / M_PI * feedforward_turn_;
 
+  // the integral holds ki * e so the gains can change without a bump
+  schedule_gains(_v_l_soll, _v_r_soll);
+
   // filtern: grosser aenderungen deuten auf fehlerhafte messungen hin
-  if (fabs(_v_l_ist - last_v_l_ist) < 0.19)
+  if (fabs(_v_l_ist - last_v_l_ist_) < max_v_jump_)
   {
-    // filter glaettung werte speichern
-    v_l_list[vl_index] = _v_l_ist;
-    f_v_l_ist = (v_l_list[vl_index] + v_l_list[vl_index - 1] + v_l_list[vl_index - 2] + v_l_list[vl_index - 3]) / 4.0;
-    vl_index++; // achtung auf ueberlauf
-    if (vl_index >= MAX_V_LIST)
-    {
-      vl_index = 3; // zum schutz vor ueberlauf kopieren bei hold einen mehr kopieren
-      for (i = 0; i < 3; i++)
-        v_l_list[2 - i] = v_l_list[MAX_V_LIST - i - 1];
-    }
+    // filter glaettung
+    f_v_l_ist = v_filter_l_->filter(_v_l_ist);
 
-    el = _v_l_soll - f_v_l_ist;
-    del = (el - last_el) / dt;
-    int_el += el * dt;
+    el_ = _v_l_soll - f_v_l_ist;
+    del = (el_ - last_el_) / dt;
+    int_el_ += ki_l * el_ * dt;
 
-    zl = kp_l * el + kd_l * del + ki_l * int_el + _v_l_soll + turn_feedforward_l;
+    zl_ = kp_l * el_ + kd_l * del + int_el_ + _v_l_soll + turn_feedforward_l;
 
-    last_el = el; // last e
+    last_el_ = el_; // last e
   }
 
   // filtern: grosser aenderungen deuten auf fehlerhafte messungen hin
-  if (fabs(_v_r_ist - last_v_r_ist) < 0.19)
+  if (fabs(_v_r_ist - last_v_r_ist_) < max_v_jump_)
   {
-    // filter glaettung werte speichern
-    v_r_list[vr_index] = _v_r_ist;
-    f_v_r_ist = (v_r_list[vr_index] + v_r_list[vr_index - 1] + v_r_list[vr_index - 2] + v_r_list[vr_index - 3]) / 4.0;
-    vr_index++; // achtung auf ueberlauf
-    if (vr_index >= MAX_V_LIST)
-    {
-      vr_index = 3; // zum schutz vor ueberlauf kopieren bei hold einen mehr kopieren
-      for (i = 0; i < 3; i++)
-      {
-        v_r_list[2 - i] = v_r_list[MAX_V_LIST - i - 1];
-      }
-    }
+    // filter glaettung
+    f_v_r_ist = v_filter_r_->filter(_v_r_ist);
 
-    er = _v_r_soll - f_v_r_ist;
-    der = (er - last_er) / dt;
-    int_er += er * dt;
+    er_ = _v_r_soll - f_v_r_ist;
+    der = (er_ - last_er_) / dt;
+    int_er_ += ki_r * er_ * dt;
 
-    zr = kp_r * er + kd_r * der + ki_r * int_er + _v_r_soll + turn_feedforward_r;
+    zr_ = kp_r * er_ + kd_r * der + int_er_ + _v_r_soll + turn_feedforward_r;
 
-    last_er = er; // last e
+    last_er_ = er_; // last e
   }
 
   // range check und antiwindup stellgroessenbeschraenkung
   // verhindern das der integrier weiter hochlaeuft
   // deshalb die vorher addierten werte wieder abziehen
-  if (zl > vmax_)
+  if (zl_ > vmax_)
   {
-    zl = vmax_;
-    int_el -= el * dt;
+    zl_ = vmax_;
+    int_el_ -= ki_l * el_ * dt;
   }
-  if (zr > vmax_)
+  if (zr_ > vmax_)
   {
-    zr = vmax_;
-    int_er -= er * dt;
+    zr_ = vmax_;
+    int_er_ -= ki_r * er_ * dt;
   }
-  if (zl < -vmax_)
+  if (zl_ < -vmax_)
   {
-    zl = -vmax_;
-    int_el -= el * dt;
+    zl_ = -vmax_;
+    int_el_ -= ki_l * el_ * dt;
   }
-  if (zr < -vmax_)
+  if (zr_ < -vmax_)
   {
-    zr = -vmax_;
-    int_er -= er * dt;
+    zr_ = -vmax_;
+    int_er_ -= ki_r * er_ * dt;
   }
 
   // reduzieren
@@ -249,30 +381,99 @@ void Kurt::set_wheel_speed2(double _v_l_soll, double _v_r_soll, double _v_l_ist,
      der Motor ein wenig entlastet wird. bei vorgabe von max
      geschwindigkeit braucht es so 5 * 10 ms bevor die Maximale
      Kraft anliegt */
-  if ((zl - last_zl) > step_max)
+  if ((zl_ - last_zl_) > step_max)
   {
-    zl = last_zl + step_max;
+    zl_ = last_zl_ + step_max;
   }
-  if ((zl - last_zl) < -step_max)
+  if ((zl_ - last_zl_) < -step_max)
   {
-    zl = last_zl - step_max;
+    zl_ = last_zl_ - step_max;
   }
-  if ((zr - last_zr) > step_max)
+  if ((zr_ - last_zr_) > step_max)
   {
-    zr = last_zr + step_max;
+    zr_ = last_zr_ + step_max;
   }
-  if ((zr - last_zr) < -step_max)
+  if ((zr_ - last_zr_) < -step_max)
   {
-    zr = last_zr - step_max;
+    zr_ = last_zr_ - step_max;
   }
 
   // store old val for deviation plotting
-  last_v_l_ist = _v_l_ist;
-  last_v_r_ist = _v_r_ist;
-  last_zl = zl;
-  last_zr = zr;
+  last_v_l_ist_ = _v_l_ist;
+  last_v_r_ist_ = _v_r_ist;
+  last_zl_ = zl_;
+  last_zr_ = zr_;
+
+  if (learn_feedforward_)
+  {
+    // while turning the turn feedforward and the track slip are in the
+    // output, they do not belong to the speedtable
+    if (_omega == 0.0)
+    {
+      learn_pwm_v_tab(0, _v_l_soll, _v_l_soll + int_el_, el_);
+      learn_pwm_v_tab(1, _v_r_soll, _v_r_soll + int_er_, er_);
+    }
+    else
+    {
+      learn_steady_[0] = learn_steady_[1] = 0;
+    }
+    if (++learn_cycle_ >= learn_save_cycles_)
+    {
+      learn_cycle_ = 0;
+      if (learn_dirty_)
+      {
+        save_learned_table();
+        learn_dirty_ = false;
+      }
+    }
+  }
+
+  set_wheel_speed1(zl_, zr_, 0, 0);
+}
+
+// Leerlauf adaption: at a steady setpoint the integral holds what the table
+// is missing, so the table should map v_soll to the pwm of z = v_soll + integral.
+// Move the knots around v_soll a bounded step towards it once per second,
+// which gives the integrator time to unwind between the updates.
+void Kurt::learn_pwm_v_tab(int wheel, double v_soll, double z, double e)
+{
+  const int steady_cycles = 100;
+  const double max_error = 0.02; // in m/s
+
+  if (fabs(v_soll - learn_v_soll_[wheel]) > 1e-3)
+  {
+    learn_v_soll_[wheel] = v_soll;
+    learn_steady_[wheel] = 0;
+    return;
+  }
+
+  if (fabs(v_soll) < 0.05 || fabs(e) > max_error || fabs(z) >= vmax_ || v_soll * z <= 0.0)
+  {
+    learn_steady_[wheel] = 0;
+    return;
+  }
+  if (++learn_steady_[wheel] < steady_cycles)
+    return;
+  learn_steady_[wheel] = 0;
+
+  double delta = pwm_v_.pwm(fabs(z), wheel) - pwm_v_.pwm(fabs(v_soll), wheel);
+  double step = std::max(-learn_max_step_, std::min(learn_max_step_, learn_rate_ * delta));
+  if (fabs(step) < 1e-3)
+    return;
+
+  // nearest knot
+  int index = std::min(pwm_v_.size() - 1, (int)(fabs(v_soll) / vmax_ * nr_v_ + 0.5));
+  for (int i = std::max(1, index - learn_width_); i <= std::min(pwm_v_.size() - 1, index + learn_width_); i++)
+  {
+    double weight = 1.0 - (double)abs(i - index) / (learn_width_ + 1);
+    double &knot = pwm_v_.knot(i, wheel);
+    knot = std::max(0.0, std::min(1024.0, knot + step * weight));
+  }
+  // pwm must be increasing
+  pwm_v_.makeMonotone(index, wheel);
 
-  set_wheel_speed1(zl, zr, 0, 0);
+  learn_dirty_ = true;
+  KURT_DEBUG("learn_pwm_v_tab: wheel %d v: %f pwm: %f step: %f", wheel, v_soll, pwm_v_.knot(index, wheel), step);
 }
 
 void Kurt::set_wheel_speed2_mc(double _v_l_soll, double _v_r_soll, double _omega,
@@ -303,24 +504,136 @@ void Kurt::set_wheel_speed2_mc(double _v_l_soll, double _v_r_soll, double _omega
   frame.data[6] = omega >> 8;
   frame.data[7] = omega;
 
-  if(!can_.send_frame(&frame))
+  if(!send_motor_frame(frame, false))
   {
-    ROS_ERROR("set_wheel_speed2_mc: Error sending speed");
+    KURT_ERROR("set_wheel_speed2_mc: Error sending speed");
   }
 }
 
-void Kurt::set_wheel_speed(double _v_l_soll, double _v_r_soll, double _AntiWindup)
+// _omega is the commanded angular velocity in rad/s, used for the turn feedforward
+void Kurt::set_wheel_speed(double _v_l_soll, double _v_r_soll, double _omega, double _AntiWindup)
 {
+  if (watchdog_)
+    watchdog_->controlCycle();
+
+  bool stopped;
+  {
+    boost::mutex::scoped_lock lock(motor_mutex_);
+    stopped = emergency_stop_;
+    // start from rest after a watchdog stop
+    if (!stopped && resume_)
+    {
+      _AntiWindup = 0.0;
+      resume_ = false;
+      // the filters restart as well, even if the last command was zero
+      last_anti_windup_ = 1.0;
+    }
+  }
+  if (stopped)
+  {
+    k_hard_stop();
+    return;
+  }
+
+  if (bumper_stop_)
+  {
+    // keep braking until the obstacle is clear and the stop was acknowledged,
+    // the zero command also resets the integrators (AntiWindup = 0)
+    if (bumper_contact_ || _v_l_soll != 0.0 || _v_r_soll != 0.0)
+    {
+      k_hard_stop();
+      return;
+    }
+    bumper_stop_ = false;
+    KURT_INFO("Bumper stop released");
+  }
+
   if (use_microcontroller_)
   {
-    //Disable AntiWindup for now as the Kurt micro controller crashes when
-    //going from zero to full speed with it activated
-    set_wheel_speed2_mc(_v_l_soll, _v_r_soll, 0, 1.0);
+    //Disable AntiWindup unless the setpoints are jerk limited as the Kurt
+    //micro controller crashes when going from zero to full speed with it
+    //activated
+    set_wheel_speed2_mc(_v_l_soll, _v_r_soll, _omega, mc_anti_windup_ ? _AntiWindup : 1.0);
   }
   else
   {
-    set_wheel_speed2(_v_l_soll, _v_r_soll, v_encoder_left_, v_encoder_right_, 0, _AntiWindup);
+    set_wheel_speed2(_v_l_soll, _v_r_soll, v_encoder_left_, v_encoder_right_, _omega, _AntiWindup);
+  }
+}
+
+// linear interpolation of the gains between the rows of the gain table
+void Kurt::schedule_gains(double v_l, double v_r)
+{
+  if (gain_table_.empty())
+    return;
+
+  double v[2] = {fabs(v_l), fabs(v_r)};
+  // every path below overwrites them, the current gains are only a default
+  double kp[2] = {kp_l, kp_r};
+  double ki[2] = {ki_l, ki_r};
+  for (int w = 0; w < 2; w++)
+  {
+    size_t i = 0;
+    while (i + 1 < gain_table_.size() && gain_table_[i + 1].v <= v[w])
+      i++;
+    const Gains &lo = gain_table_[i];
+    const Gains &hi = gain_table_[std::min(i + 1, gain_table_.size() - 1)];
+    double t = hi.v > lo.v ? std::max(0.0, std::min(1.0, (v[w] - lo.v) / (hi.v - lo.v))) : 0.0;
+    if (w == 0)
+    {
+      kp[w] = lo.kp_l + t * (hi.kp_l - lo.kp_l);
+      ki[w] = lo.ki_l + t * (hi.ki_l - lo.ki_l);
+    }
+    else
+    {
+      kp[w] = lo.kp_r + t * (hi.kp_r - lo.kp_r);
+      ki[w] = lo.ki_r + t * (hi.ki_r - lo.ki_r);
+    }
+  }
+  kp_l = kp[0];
+  ki_l = ki[0];
+  kp_r = kp[1];
+  ki_r = ki[1];
+}
+
+// reads speed dependent gains, one row per speed (ascending):
+// v[m/s] kp_left ki_left kp_right ki_right
+bool Kurt::read_gain_table(const std::string &filename, std::vector<Gains> &table)
+{
+  FILE *fpr_gaintable = NULL;
+  Gains gains;
+
+  KURT_INFO("Open GainTable: %s", filename.c_str());
+  fpr_gaintable = fopen(filename.c_str(), "r");
+
+  if (fpr_gaintable == NULL)
+  {
+    KURT_ERROR("ERROR opening gaintable.");
+    return false;
+  }
+
+  table.clear();
+  int rc;
+  while ((rc = fscanf(fpr_gaintable, "%lf %lf %lf %lf %lf", &gains.v, &gains.kp_l, &gains.ki_l, &gains.kp_r, &gains.ki_r)) == 5)
+  {
+    if (!table.empty() && gains.v <= table.back().v)
+    {
+      KURT_ERROR("ERROR reading gaintable: speeds must be ascending.");
+      fclose(fpr_gaintable);
+      table.clear();
+      return false;
+    }
+    table.push_back(gains);
+  }
+  fclose(fpr_gaintable);
+
+  if (rc != EOF || table.empty())
+  {
+    KURT_ERROR("ERROR reading gaintable.");
+    table.clear();
+    return false;
   }
+  return true;
 }
 
 // reads init data from pmw to speed experiment
@@ -331,12 +644,12 @@ bool Kurt::read_speed_to_pwm_leerlauf_tabelle(const std::string &filename, int *
   double t, v, vl, vr;
   int pwm;
 
-  ROS_INFO("Open FeedForwardTabelle: %s", filename.c_str());
+  KURT_INFO("Open FeedForwardTabelle: %s", filename.c_str());
   fpr_fftable = fopen(filename.c_str(), "r");
 
   if (fpr_fftable == NULL)
   {
-    ROS_ERROR("ERROR opening speedtable.");
+    KURT_ERROR("ERROR opening speedtable.");
     return false;
   }
 
@@ -347,7 +660,7 @@ bool Kurt::read_speed_to_pwm_leerlauf_tabelle(const std::string &filename, int *
   {
     if(fscanf(fpr_fftable, "%lf %lf %lf %lf %d", &t, &v, &vl, &vr, &pwm) == EOF)
     {
-      ROS_ERROR("ERROR reading speedtable.");
+      KURT_ERROR("ERROR reading speedtable.");
       fclose(fpr_fftable);
       return false;
     }
@@ -358,61 +671,77 @@ bool Kurt::read_speed_to_pwm_leerlauf_tabelle(const std::string &filename, int *
   return true;
 }
 
-// generate reverse speedtable
-void Kurt::make_pwm_v_tab(int nr, double *v_pwm_l, double *v_pwm_r, int nr_v, int **pwm_v_l, int **pwm_v_r, double *v_max)
+// hands a copy of the learned table to the writer thread, so the file
+// is written and synced off the control loop
+void Kurt::save_learned_table()
 {
-  int i, index_l, index_r;
-  //int last_l, last_r;
-  double v_max_l = 0.0, v_max_r = 0.0;
-  *v_max = 0.0;
+  {
+    boost::mutex::scoped_lock lock(learn_mutex_);
+    learn_save_.filename = learned_table_file_;
+    learn_save_.pwm_v = pwm_v_;
+    learn_save_.v_pwm_l = v_pwm_l_;
+    learn_save_.v_pwm_r = v_pwm_r_;
+    learn_save_.vmax = vmax_;
+    learn_save_pending_ = true;
+  }
+  learn_cond_.notify_one();
+}
+
+void Kurt::run_learn_writer()
+{
+  LearnedTable table;
+  while (true)
+  {
+    {
+      boost::mutex::scoped_lock lock(learn_mutex_);
+      while (!learn_save_pending_ && !learn_stop_)
+        learn_cond_.wait(lock);
+      if (!learn_save_pending_)
+        return;
+      table = learn_save_;
+      learn_save_pending_ = false;
+    }
+    write_speed_to_pwm_leerlauf_tabelle(table);
+  }
+}
 
-  *pwm_v_l = (int *)calloc(nr_v + 1, sizeof(int));
-  *pwm_v_r = (int *)calloc(nr_v + 1, sizeof(int));
+// writes the learned table in the speedtable format, atomically by renaming
+// a completely written temporary file
+bool Kurt::write_speed_to_pwm_leerlauf_tabelle(const LearnedTable &table)
+{
+  const std::string &filename = table.filename;
 
-  // check max wheel speed left right wheel
-  for (i = 0; i < nr; i++)
+  std::string tmpname = filename + ".tmp";
+  FILE *fpw_fftable = fopen(tmpname.c_str(), "w");
+  if (fpw_fftable == NULL)
   {
-    if (v_pwm_l[i] > v_max_l)
-      v_max_l = v_pwm_l[i];
-    if (v_pwm_r[i] > v_max_r)
-      v_max_r = v_pwm_r[i];
-    *v_max = std::min(v_max_l, v_max_r);
+    KURT_ERROR("ERROR opening learned speedtable %s.", tmpname.c_str());
+    return false;
   }
 
-  // diskretisieren
-  for (i = 0; i < nr; i++)
+  for (int pwm = 0; pwm < (int)table.v_pwm_l.size(); pwm++)
   {
-    index_l = std::min(nr_v, std::max(0, (int)((v_pwm_l[i]) * (nr_v) / *v_max)));
-    (*pwm_v_l)[index_l] = i;
-    index_r = std::min(nr_v, std::max(0, (int)((v_pwm_r[i]) * (nr_v) / *v_max)));
-    (*pwm_v_r)[index_r] = i;
+    double v[2];
+    const std::vector<double> *v_pwm[2] = {&table.v_pwm_l, &table.v_pwm_r};
+    for (int wheel = 0; wheel < 2; wheel++)
+    {
+      // inverse of the learned table, the recorded values above its range
+      if (pwm > table.pwm_v.pwm(table.vmax, wheel))
+        v[wheel] = std::max(table.vmax, (*v_pwm[wheel])[pwm]);
+      else
+        v[wheel] = table.pwm_v.speed(pwm, wheel);
+    }
+    fprintf(fpw_fftable, "0.0 %lf %lf %lf %d\n", 0.5 * (v[0] + v[1]), v[0], v[1], pwm);
   }
-  (*pwm_v_l)[0] = 0; // for a stop
-  (*pwm_v_r)[0] = 0;
 
-  // interpolate blank entries
-  //last_l = (*pwm_v_l)[0];
-  //last_r = (*pwm_v_r)[0];
-  for (i = 1; i < nr_v; i++)
+  bool ok = fflush(fpw_fftable) == 0 && fsync(fileno(fpw_fftable)) == 0;
+  ok = fclose(fpw_fftable) == 0 && ok;
+  if (!ok || rename(tmpname.c_str(), filename.c_str()) != 0)
   {
-    // interpolation simple methode, pwm must be increasing
-    if ((*pwm_v_l)[i] < (*pwm_v_l)[i - 1])
-      (*pwm_v_l)[i] = (*pwm_v_l)[i - 1];
-    if ((*pwm_v_r)[i] < (*pwm_v_r)[i - 1])
-      (*pwm_v_r)[i] = (*pwm_v_r)[i - 1];
-    /* interpolation advancde methode
-       if ((*pwm_v_l)[i] == 0) {
-       for (j = i+1; j <= nr_v; j++)
-       if ((*pwm_v_l)[j] != 0) { next_l = (*pwm_v_l)[j]; j = nr_v; }
-       (*pwm_v_l)[i] = (next_l + last_l ) / 2;
-       } else last_l = (*pwm_v_l)[i];
-       if ((*pwm_v_r)[i] == 0) {
-       for (j = i+1; j <= nr_v; j++)
-       if ((*pwm_v_r)[j] != 0) {next_r = (*pwm_v_r)[j];j = nr_v;}
-       (*pwm_v_r)[i] = (next_r + last_r ) / 2;
-       } else last_r = (*pwm_v_r)[i];
-       */
+    KURT_ERROR("ERROR writing learned speedtable %s.", filename.c_str());
+    return false;
   }
+  return true;
 }
 
 void Kurt::odometry(int wheel_a, int wheel_b)
@@ -427,16 +756,81 @@ void Kurt::odometry(int wheel_a, int wheel_b)
   // calc different speeds in meter / sec
   v_encoder_left_ = wheel_L / time_diff;
   v_encoder_right_ = wheel_R / time_diff;
+
+  // a single tick of jitter is still standing
+  if (abs(wheel_a) <= 1 && abs(wheel_b) <= 1)
+    standing_cycles_++;
+  else
+    standing_cycles_ = 0;
+
+  double dtheta_y = integrate_odometry(wheel_L, wheel_R, time_diff);
+
   double v_encoder = (v_encoder_right_ + v_encoder_left_) * 0.5;
   // angular velocity in rad/s
-  double v_encoder_angular = (v_encoder_right_ - v_encoder_left_) / axis_length_ * turning_adaptation_;
+  double v_encoder_angular = -dtheta_y / time_diff;
+
+  // for the tilt sensor: linear and centripetal acceleration
+  double a = (v_encoder - last_v_encoder_) / time_diff;
+  last_v_encoder_ = v_encoder;
+  acceleration_lin_ += 0.2 * (a - acceleration_lin_);
+  acceleration_ = fabs(acceleration_lin_) + fabs(v_encoder * v_encoder_angular);
+
+  // pose in the conventions of send_odometry
+  double z = z_from_encoder_, x = x_from_encoder_, theta = theta_from_encoder_;
+  if (odometry_source_ == ODOMETRY_MCU && mcu_odometry_.poseValid())
+  {
+    z = mcu_odometry_.x();
+    x = -mcu_odometry_.y();
+    theta = -mcu_odometry_.yaw();
+  }
+  comm_.send_odometry(z, x, theta, v_encoder, v_encoder_angular, wheel_a, wheel_b,
+      v_encoder_left_, v_encoder_right_, odom_covariance_.pose(), odom_covariance_.twist());
+
+  if (grid_)
+  {
+    grid_->move(z, -x, -theta);
+    if (++grid_cycles_ >= grid_publish_cycles_)
+    {
+      grid_cycles_ = 0;
+      comm_.send_local_grid(*grid_, frame_stamp_);
+    }
+  }
+
+  if (ekf_)
+    comm_.send_odom_combined(ekf_->x(), ekf_->y(), ekf_->yaw(), ekf_->covariance(), frame_stamp_);
+}
+
+// pose, covariance and fused pose, returns the turn in rad (clockwise)
+double Kurt::integrate_odometry(double wheel_L, double wheel_R, double time_diff)
+{
+  // turning adaptation per track, learned from the gyro or static
+  double adaptation_l = slip_ ? slip_->left() : turning_adaptation_;
+  double adaptation_r = slip_ ? slip_->right() : turning_adaptation_;
+  if (slip_)
+    slip_->addWheels(wheel_L / axis_length_, wheel_R / axis_length_);
+
+  double dtheta_y = (wheel_L * adaptation_l - wheel_R * adaptation_r) / axis_length_;
+
+  // heading of the published pose in ROS conventions, theta_from_encoder_
+  // turns clockwise and stays 0 while the micro controller integrates
+  double heading = -theta_from_encoder_;
+  if (odometry_source_ == ODOMETRY_MCU && mcu_odometry_.poseValid())
+    heading = mcu_odometry_.yaw();
+  odom_covariance_.update(wheel_L, wheel_R, heading, time_diff);
+  if (ekf_)
+    ekf_->predict(0.5 * (wheel_L + wheel_R), -dtheta_y);
+
+  // the pose comes from the micro controller
+  if (odometry_source_ == ODOMETRY_MCU)
+    return dtheta_y;
 
   // calc position deltas
-  double local_dx, local_dz, dtheta_y = 0.0;
+  double local_dx, local_dz;
   const double EPSILON = 0.0001;
 
-  if (fabs(wheel_L - wheel_R) < EPSILON)
+  if (fabs(wheel_L * adaptation_l - wheel_R * adaptation_r) < EPSILON)
   {
+    dtheta_y = 0.0;
     if (fabs(wheel_L) < EPSILON)
     {
       local_dx = 0.0;
@@ -452,32 +846,46 @@ void Kurt::odometry(int wheel_a, int wheel_b)
   {
     double hypothenuse = 0.5 * (wheel_L + wheel_R);
 
-    dtheta_y = (wheel_L - wheel_R) / axis_length_ * turning_adaptation_;
-
     local_dx = hypothenuse * sin(dtheta_y);
     local_dz = hypothenuse * cos(dtheta_y);
   }
 
   // Odometrie : Koordinatentransformation in Weltkoordinaten
-  static double x_from_encoder = 0.0;
-  static double z_from_encoder = 0.0;
-  static double theta_from_encoder = 0.0;
-
-  x_from_encoder += local_dx * cos(theta_from_encoder) + local_dz * sin(theta_from_encoder);
-  z_from_encoder += -local_dx * sin(theta_from_encoder) + local_dz * cos(theta_from_encoder);
+  x_from_encoder_ += local_dx * cos(theta_from_encoder_) + local_dz * sin(theta_from_encoder_);
+  z_from_encoder_ += -local_dx * sin(theta_from_encoder_) + local_dz * cos(theta_from_encoder_);
 
-  theta_from_encoder += dtheta_y;
-  if (theta_from_encoder > M_PI)
-    theta_from_encoder -= 2.0 * M_PI;
-  if (theta_from_encoder < -M_PI)
-    theta_from_encoder += 2.0 * M_PI;
+  theta_from_encoder_ += dtheta_y;
+  if (theta_from_encoder_ > M_PI)
+    theta_from_encoder_ -= 2.0 * M_PI;
+  if (theta_from_encoder_ < -M_PI)
+    theta_from_encoder_ += 2.0 * M_PI;
 
-  comm_.send_odometry(z_from_encoder, x_from_encoder, theta_from_encoder, v_encoder, v_encoder_angular, wheel_a, wheel_b, v_encoder_left_, v_encoder_right_);
+  return dtheta_y;
 }
 
 ////////////////// rotunit //////////////////////////////////////
 
+void Kurt::setRotunitControl(double kp, double ki, double period)
+{
+  rotunit_kp_ = kp;
+  rotunit_ki_ = ki;
+  rotunit_period_ = period;
+  rotunit_closed_loop_ = true;
+}
+
 void Kurt::can_rotunit_send(double speed)
+{
+  rotunit_target_ = speed;
+  rotunit_command_ = speed;
+  rotunit_integral_ = 0.0;
+  rotunit_window_start_ = -1.0;
+  // resent when the CAN link comes back
+  use_rotunit_ = true;
+
+  can_rotunit_send_ticks(speed);
+}
+
+bool Kurt::can_rotunit_send_ticks(double speed)
 {
   int ticks =  (int)(speed / (2.0 * M_PI) * 10240 / 20);
   can_frame frame;
@@ -494,23 +902,93 @@ void Kurt::can_rotunit_send(double speed)
 
   if(!can_.send_frame(&frame))
   {
-    ROS_ERROR("can_rotunit_send: Error sending rotunit speed");
+    KURT_ERROR("can_rotunit_send: Error sending rotunit speed");
+    return false;
   }
-  else
+  return true;
+}
+
+// measures the angular velocity over a window of rotunit_period_ and trims
+// the commanded speed with a PI controller. The firmware only takes whole
+// ticks, so the command dithers between neighbouring tick values and the
+// integrator keeps the mean rate on target.
+void Kurt::rotunit_control(double rot)
+{
+  double now = clock_->now();
+  if (rotunit_window_start_ < 0.0)
   {
-    use_rotunit_ = true;
+    rotunit_window_start_ = now;
+    rotunit_window_angle_ = 0.0;
+    rotunit_last_angle_ = rot;
+    return;
   }
+
+  double delta = remainder(rot - rotunit_last_angle_, 2.0 * M_PI);
+  rotunit_window_angle_ += delta;
+  rotunit_last_angle_ = rot;
+
+  double dt = now - rotunit_window_start_;
+  if (dt < rotunit_period_)
+    return;
+
+  double measured = rotunit_window_angle_ / dt;
+  double error = rotunit_target_ - measured;
+  rotunit_integral_ += error * dt;
+  rotunit_command_ = rotunit_target_ + rotunit_kp_ * error + rotunit_ki_ * rotunit_integral_;
+
+  // never reverse or more than double the requested speed
+  if (rotunit_target_ >= 0.0)
+    rotunit_command_ = std::max(0.0, std::min(2.0 * rotunit_target_, rotunit_command_));
+  else
+    rotunit_command_ = std::min(0.0, std::max(2.0 * rotunit_target_, rotunit_command_));
+
+  KURT_DEBUG("rotunit_control: target: %f measured: %f command: %f", rotunit_target_, measured, rotunit_command_);
+  can_rotunit_send_ticks(rotunit_command_);
+
+  rotunit_window_start_ = now;
+  rotunit_window_angle_ = 0.0;
 }
 
 void Kurt::can_rotunit(const can_frame &frame)
 {
   int rot = (frame.data[1] << 8) + frame.data[2];
   double rot2 = rot * 2 * M_PI / 10240;
+  if (rotunit_closed_loop_ && rotunit_target_ != 0.0)
+    rotunit_control(rot2);
   comm_.send_rotunit(rot2);
 }
 
 //////////////////// Kurt Sensor ////////////////////////////////
 
+// range sensors on base_link (see urdf/infrared_sonar.urdf.xacro)
+enum
+{
+  IR_RIGHT_FRONT, IR_RIGHT, IR_RIGHT_BACK, IR_BACK, IR_LEFT_BACK, IR_LEFT, IR_LEFT_FRONT, ULTRASOUND_FRONT
+};
+
+static const struct
+{
+  double x, y, yaw; // [m], [rad]
+  double fov, max; // [rad], [m]
+} range_sensors[] = {
+  { 0.203, -0.153, -M_PI / 4.0, IR_FOV, IR_MAX },
+  { 0.0, -0.165, -M_PI / 2.0, IR_FOV, IR_MAX },
+  { -0.203, -0.153, -3.0 * M_PI / 4.0, IR_FOV, IR_MAX },
+  { -0.217, 0.0, M_PI, IR_FOV, IR_MAX },
+  { -0.203, 0.153, 3.0 * M_PI / 4.0, IR_FOV, IR_MAX },
+  { 0.0, 0.165, M_PI / 2.0, IR_FOV, IR_MAX },
+  { 0.203, 0.153, M_PI / 4.0, IR_FOV, IR_MAX },
+  { 0.217, 0.0, 0.0, SONAR_FOV, SONAR_MAX } };
+
+// range in cm, < 0 if invalid
+void Kurt::grid_range(int sensor, int range)
+{
+  if (!grid_ || range < 0)
+    return;
+  grid_->insertRange(range_sensors[sensor].x, range_sensors[sensor].y, range_sensors[sensor].yaw,
+      range_sensors[sensor].fov, range / 100.0, range_sensors[sensor].max);
+}
+
 void Kurt::can_encoder(const can_frame &frame)
 {
   int left_encoder = 0, right_encoder = 0;
@@ -524,6 +1002,8 @@ void Kurt::can_encoder(const can_frame &frame)
   else
     right_encoder = (frame.data[2] << 8) + frame.data[3];
 
+  received_ticks_l_ += left_encoder;
+  received_ticks_r_ += right_encoder;
   odometry(left_encoder, right_encoder);
 }
 
@@ -549,6 +1029,7 @@ void Kurt::can_sonar8_9(const can_frame &frame)
 {
   int sonar1 = normalize_ir((frame.data[2] << 8) + frame.data[3]);
 
+  grid_range(IR_LEFT_BACK, sonar1);
   comm_.send_sonar_leftBack(sonar1);
 }
 
@@ -559,6 +1040,10 @@ void Kurt::can_sonar4_7(const can_frame &frame)
   int sonar2 = normalize_ir((frame.data[4] << 8) + frame.data[5]);
   int sonar3 = normalize_ir((frame.data[6] << 8) + frame.data[7]);
 
+  grid_range(IR_RIGHT_FRONT, sonar0);
+  grid_range(ULTRASOUND_FRONT, sonar1);
+  grid_range(IR_LEFT_FRONT, sonar2);
+  grid_range(IR_LEFT, sonar3);
   comm_.send_sonar_front_usound_leftFront_left(sonar0, sonar1, sonar2, sonar3);
 }
 
@@ -568,9 +1053,60 @@ void Kurt::can_sonar0_3(const can_frame &frame)
   int sonar1 = normalize_ir((frame.data[2] << 8) + frame.data[3]);
   int sonar2 = normalize_ir((frame.data[4] << 8) + frame.data[5]);
 
+  grid_range(IR_BACK, sonar0);
+  grid_range(IR_RIGHT_BACK, sonar1);
+  grid_range(IR_RIGHT, sonar2);
   comm_.send_sonar_back_rightBack_rightFront(sonar0, sonar1, sonar2);
 }
 
+// x[3], y[3], orientation[2], signed
+void Kurt::can_deadreck(const can_frame &frame)
+{
+  long x = (frame.data[0] << 16) + (frame.data[1] << 8) + frame.data[2];
+  long y = (frame.data[3] << 16) + (frame.data[4] << 8) + frame.data[5];
+  int orientation = (frame.data[6] << 8) + frame.data[7];
+  if (x & 0x800000)
+    x -= 0x1000000;
+  if (y & 0x800000)
+    y -= 0x1000000;
+  if (orientation & 0x8000)
+    orientation -= 0x10000;
+
+  mcu_odometry_.setPose(x * DEADRECK_POSITION_SCALE, y * DEADRECK_POSITION_SCALE,
+      orientation * DEADRECK_ORIENTATION_SCALE);
+
+  if (odometry_source_ != ODOMETRY_BOTH)
+    return;
+
+  double position_error, yaw_error;
+  bool consistent;
+  if (mcu_odometry_.check(z_from_encoder_, -x_from_encoder_, -theta_from_encoder_,
+        frame_stamp_ > 0.0 ? frame_stamp_ : clock_->now(), position_error, yaw_error, consistent))
+  {
+    if (!consistent)
+      KURT_WARN_THROTTLE(10.0, "odometry of host and micro controller differ by %.3f m, %.3f rad",
+          position_error, yaw_error);
+    comm_.send_odometry_check(position_error, yaw_error, consistent);
+  }
+}
+
+// accumulated encoder ticks, left[4] and right[4], recover lost CAN_ENCODER frames
+void Kurt::can_getspeed(const can_frame &frame)
+{
+  long accumulated[2] = {
+    (long)(int32_t)(((uint32_t)frame.data[0] << 24) + (frame.data[1] << 16) + (frame.data[2] << 8) + frame.data[3]),
+    (long)(int32_t)(((uint32_t)frame.data[4] << 24) + (frame.data[5] << 16) + (frame.data[6] << 8) + frame.data[7]) };
+  long received[2] = { received_ticks_l_, received_ticks_r_ };
+  long lost[2];
+
+  if (!mcu_odometry_.lostTicks(accumulated, received, lost))
+    return;
+
+  KURT_DEBUG("recovered lost encoder ticks: %ld %ld", lost[0], lost[1]);
+  integrate_odometry(wheel_perimeter_ * lost[0] / ticks_per_turn_of_wheel_,
+      wheel_perimeter_ * lost[1] / ticks_per_turn_of_wheel_, 0.01);
+}
+
 void Kurt::can_tilt_comp(const can_frame &frame)
 {
   double a0, a1;
@@ -585,19 +1121,34 @@ void Kurt::can_tilt_comp(const can_frame &frame)
   a0 = ((double)t0 - 32768.0) / 3932.0;
   a1 = ((double)t1 - 32768.0) / 3932.0;
 
-  // calculate angles and convert do deg
-  double tilt_lr = asin(a0);
-  double tilt_fb = asin(a1);
+  // calculate angles
+  double tilt_lr = asin(std::max(-1.0, std::min(1.0, a0)));
+  double tilt_fb = asin(std::max(-1.0, std::min(1.0, a1)));
 
-  double roll = tilt_lr * 180.0 / M_PI;
-  double pitch = tilt_fb * 180.0 / M_PI;
-  comm_.send_pitch_roll(pitch, roll);
+  orientation_.updateTilt(tilt_lr, tilt_fb, acceleration_, frame_dt(tilt_stamp_));
+}
+
+// dt since the last frame of the same kind, from the reception stamps
+double Kurt::frame_dt(double &last_stamp)
+{
+  double dt = 0.01;
+  if (frame_stamp_ > 0.0)
+  {
+    if (last_stamp > 0.0 && frame_stamp_ - last_stamp > 0.0 && frame_stamp_ - last_stamp < 0.1)
+      dt = frame_stamp_ - last_stamp;
+    last_stamp = frame_stamp_;
+  }
+  return dt;
 }
 
-void Kurt::can_gyro_mc1(const can_frame &frame)
+// the gyro of the second C167 is only used on robots without the first one
+void Kurt::can_gyro(const can_frame &frame, int mc)
 {
-  static int gyro_offset_read = 0;
-  static double offset, delta; // initial offset
+  if (mc == 1)
+    gyro_mc1_seen_ = true;
+  else if (gyro_mc1_seen_)
+    return;
+
   signed long gyro_raw;
 
   gyro_raw = (frame.data[0] << 24) + (frame.data[1] << 16)
@@ -610,28 +1161,109 @@ void Kurt::can_gyro_mc1(const can_frame &frame)
   double tmp = (sqrt(sigma_deg) * M_PI / 180.0);
   double sigma = tmp * tmp;
 
-  // wait until gyro is stable
-  if (gyro_offset_read++ < 100)
-    return;
+  // learn the drift while the wheels have not moved for 0.1 s
+  theta = gyro_bias_.update(theta, standing_cycles_ >= 10);
+  if (ekf_)
+    ekf_->updateYaw(theta, std::max(sigma, ekf_gyro_variance_));
+  if (slip_ && slip_->addYaw(theta))
+  {
+    odom_covariance_.setTurningAdaptation(slip_->turningAdaptation());
+    comm_.send_slip(slip_->turningAdaptation(), slip_->slipLeft(), slip_->slipRight());
+  }
+
+  orientation_.updateYaw(theta, frame_dt(gyro_stamp_));
+  comm_.send_imu(orientation_.roll(), orientation_.pitch(), orientation_.yaw(), orientation_.yawRate(),
+      tilt_variance_, sigma, frame_stamp_);
+}
 
-  if(gyro_offset_read == 100)
+// byte 0: bumper contacts, byte 1: remote control buttons, one bit each
+void Kurt::can_bumperc(const can_frame &frame)
+{
+  int bumper = frame.data[0];
+  int remote_control = frame.data[1];
+
+  bumper_contact_ = (bumper & bumper_mask_) || (remote_control & remote_control_mask_);
+  if (bumper_contact_ && !bumper_stop_)
   {
-    offset = theta;
-    delta = offset / 100.0;
-    if (delta >  M_PI) delta -= 2.0 * M_PI;
-    if (delta < -M_PI) delta += 2.0 * M_PI;
+    // brake right here on the receive path instead of waiting for the
+    // planner to answer with a zero cmd_vel. The brake frame goes through
+    // send_motor_frame like the one of the watchdog, CAN serializes the sends
+    k_hard_stop();
+    bumper_stop_ = true;
+    KURT_WARN("Bumper stop (bumper %02X, remote control %02X)", bumper, remote_control);
   }
 
-  offset += delta;
-  if (offset >  M_PI) offset -= 2.0 * M_PI;
-  if (offset < -M_PI) offset += 2.0 * M_PI;
+  comm_.send_bumper(bumper, remote_control, bumper_stop_);
+}
 
-  theta -= offset;
+// Kurt switched off, interface down or bus off and back. The pose is kept,
+// the robot continues from rest and the rotunit gets its speed again.
+void Kurt::set_can_available(bool available)
+{
+  can_available_ = available;
+  if (available)
+  {
+    KURT_INFO("Kurt available");
+    {
+      boost::mutex::scoped_lock lock(motor_mutex_);
+      resume_ = true;
+    }
+    if (use_rotunit_)
+    {
+      rotunit_window_start_ = -1.0;
+      can_rotunit_send_ticks(rotunit_command_);
+    }
+  }
+  else
+  {
+    KURT_ERROR("Kurt not available");
+    v_encoder_left_ = v_encoder_right_ = 0.0;
+    standing_cycles_ = 0;
+    // a restarted micro controller integrates its heading from 0 again
+    gyro_bias_.rebase();
+    if (slip_)
+      slip_->restart();
+    mcu_.restart();
+    mcu_odometry_.restart();
+  }
+  comm_.send_can_available(available);
+}
+
+////////////////// micro controller health //////////////////////
+
+void Kurt::can_info(const can_frame &frame)
+{
+  int hw_id = (frame.data[0] << 8) + frame.data[1];
+  int fw_version = (frame.data[2] << 8) + frame.data[3];
+  unsigned long loop = ((unsigned long)frame.data[4] << 24) + (frame.data[5] << 16)
+    + (frame.data[6] << 8) + frame.data[7];
+
+  // the loop rate needs the exact reception time
+  mcu_.info(hw_id, fw_version, loop, frame_stamp_ > 0.0 ? frame_stamp_ : clock_->now());
+  report_mcu_health();
+}
 
-  if (theta >  M_PI) theta -= 2.0 * M_PI;
-  if (theta < -M_PI) theta += 2.0 * M_PI;
+// currents in mA, the temperature is sent in deg C
+void Kurt::can_adc12_15(const can_frame &frame)
+{
+  int current_right = (frame.data[0] << 8) + frame.data[1];
+  int current_left = (frame.data[2] << 8) + frame.data[3];
+  int temperature = (frame.data[6] << 8) + frame.data[7];
 
-  comm_.send_gyro(theta, sigma);
+  mcu_.adc(current_left / 1000.0, current_right / 1000.0, temperature);
+  report_mcu_health();
+}
+
+void Kurt::report_mcu_health()
+{
+  double now = frame_stamp_ > 0.0 ? frame_stamp_ : clock_->now();
+  if (!mcu_.due(now))
+    return;
+
+  const McuHealth &health = mcu_.health(now);
+  if (health.level != MCU_OK)
+    KURT_WARN_THROTTLE(10.0, "Kurt micro controller: %s", health.message.c_str());
+  comm_.send_mcu_health(health);
 }
 
 int Kurt::can_read_fifo()
@@ -639,7 +1271,20 @@ int Kurt::can_read_fifo()
   can_frame frame;
 
   if(!can_.receive_frame(&frame))
+  {
+    // single errors do not count, only a silent bus
+    if (can_available_ && clock_->now() - last_frame_time_ >= CAN_RECEIVE_TIMEOUT)
+      set_can_available(false);
     return -1;
+  }
+
+  last_frame_time_ = clock_->now();
+  frame_stamp_ = can_.stamp();
+  if (!can_available_)
+    set_can_available(true);
+
+  if (watchdog_)
+    watchdog_->frameReceived();
 
   switch (frame.can_id) {
     case CAN_ADC00_03:
@@ -658,46 +1303,46 @@ int Kurt::can_read_fifo()
       can_tilt_comp(frame);
       break;
     case CAN_GYRO_MC1:
-      can_gyro_mc1(frame);
+      can_gyro(frame, 1);
+      break;
+    case CAN_GYRO_MC2:
+      can_gyro(frame, 2);
       break;
     case CAN_GETROTUNIT:
       can_rotunit(frame);
       break;
-    /*case CAN_CONTROL:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (control message)", frame.can_id);
+    case CAN_BUMPERC:
+      can_bumperc(frame);
       break;
     case CAN_INFO_1:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (info message)", frame.can_id);
+      can_info(frame);
       break;
     case CAN_ADC12_15:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 12 - 15)", frame.can_id);
+      can_adc12_15(frame);
       break;
-    case CAN_BUMPERC:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (bumpers and remote control)", frame.can_id);
+    case CAN_DEADRECK:
+      can_deadreck(frame);
+      break;
+    case CAN_GETSPEED:
+      can_getspeed(frame);
+      break;
+    /*case CAN_CONTROL:
+      KURT_DEBUG("can_read_fifo: Unused CAN message ID: %X (control message)", frame.can_id);
       break;
     case CAN_BDC00_03:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 0 - 3)", frame.can_id);
+      KURT_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 0 - 3)", frame.can_id);
       break;
     case CAN_BDC04_07:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 4 - 7)", frame.can_id);
+      KURT_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 4 - 7)", frame.can_id);
       break;
     case CAN_BDC08_11:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 8 - 11)", frame.can_id);
+      KURT_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 8 - 11)", frame.can_id);
       break;
     case CAN_BDC12_15:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 12 - 15)", frame.can_id);
-      break;
-    case CAN_GYRO_MC2:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (data from gyro connected to 2nd C167)", frame.can_id);
-      break;
-    case CAN_DEADRECK:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X (position (dead reckoning))", frame.can_id);
-      break;
-    case CAN_GETSPEED:
-      ROS_DEBUG("can_read_fifo: Unused CAN message ID: %X current transl. and rot. speed)", frame.can_id);
+      KURT_DEBUG("can_read_fifo: Unused CAN message ID: %X (analog input channels: 12 - 15)", frame.can_id);
       break;
     default:
-      ROS_DEBUG("can_read_fifo: Unknown CAN ID: %X", frame.can_id);*/
+      KURT_DEBUG("can_read_fifo: Unknown CAN ID: %X", frame.can_id);*/
   }
 
   return frame.can_id;
@@ -1,441 +1,282 @@
+#include <cmath>
 #include <string>
 
 #include <ros/ros.h>
 #include <ros/console.h>
-
-#include <geometry_msgs/Twist.h>
-#include <nav_msgs/Odometry.h>
-#include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
-#include <sensor_msgs/JointState.h>
-#include <sensor_msgs/Imu.h>
-#include <sensor_msgs/Range.h>
-
-#include "kurt.h"
-#include "comm.h"
-
-class ROSComm : public Comm
-{
-  public:
-    ROSComm(
-        const ros::NodeHandle &n,
-        double sigma_x,
-        double sigma_theta,
-        double cov_x_y,
-        double cov_x_theta,
-        double cov_y_theta,
-        int ticks_per_turn_of_wheel) :
-      n_(n),
-      sigma_x_(sigma_x),
-      sigma_theta_(sigma_theta),
-      cov_x_y_(cov_x_y),
-      cov_x_theta_(cov_x_theta),
-      cov_y_theta_(cov_y_theta),
-      ticks_per_turn_of_wheel_(ticks_per_turn_of_wheel),
-      publish_tf_(false),
-      odom_pub_(n_.advertise<nav_msgs::Odometry> ("odom", 10)),
-      range_pub_(n_.advertise<sensor_msgs::Range> ("range", 10)),
-      imu_pub_(n_.advertise<sensor_msgs::Imu> ("imu", 10)),
-      joint_pub_(n_.advertise<sensor_msgs::JointState> ("joint_states", 1)) { }
-    virtual void send_odometry(double z, double x, double theta, double
-        v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double
-        v_encoder_left, double v_encoder_right); virtual void
-      send_sonar_leftBack(int ir_left_back);
-    virtual void send_sonar_front_usound_leftFront_left(int ir_right_front, int
-        usound, int ir_left_front, int ir_left);
-    virtual void send_sonar_back_rightBack_rightFront(int ir_back, int
-        ir_right_back, int ir_right);
-    virtual void send_pitch_roll(double pitch, double roll);
-    virtual void send_gyro(double theta, double sigma);
-    virtual void send_rotunit(double rot);
-
-    void setTFPrefix(const std::string &tf_prefix);
-
-  private:
-    void populateCovariance(nav_msgs::Odometry &msg, double v_encoder, double
-        v_encoder_angular);
-
-    ros::NodeHandle n_;
-    double sigma_x_, sigma_theta_, cov_x_y_, cov_x_theta_, cov_y_theta_;
-    int ticks_per_turn_of_wheel_;
-    bool publish_tf_;
-    std::string tf_prefix_;
 
-    tf::TransformBroadcaster odom_broadcaster_;
-    ros::Publisher odom_pub_;
-    ros::Publisher range_pub_;
-    ros::Publisher imu_pub_;
-    ros::Publisher joint_pub_;
-};
+#include "kurt_base.h"
+#include "kurt_log.h"
 
-void ROSComm::setTFPrefix(const std::string &tf_prefix)
+// the core logs to rosconsole
+static void ros_log(KurtLogLevel level, const char *message)
 {
-  tf_prefix_ = tf_prefix;
-}
-
-void ROSComm::populateCovariance(nav_msgs::Odometry &msg, double v_encoder, double v_encoder_angular)
-{
-  double odom_multiplier = 1.0;
-
-  if (fabs(v_encoder) <= 1e-8 && fabs(v_encoder_angular) <= 1e-8)
+  switch (level)
   {
-    //nav_msgs::Odometry has a 6x6 covariance matrix
-    msg.twist.covariance[0] = 1e-12;
-    msg.twist.covariance[35] = 1e-12;
-
-    msg.twist.covariance[30] = 1e-12;
-    msg.twist.covariance[5] = 1e-12;
+    case KURT_LOG_DEBUG:
+      ROS_DEBUG("%s", message);
+      break;
+    case KURT_LOG_INFO:
+      ROS_INFO("%s", message);
+      break;
+    case KURT_LOG_WARN:
+      ROS_WARN("%s", message);
+      break;
+    case KURT_LOG_ERROR:
+      ROS_ERROR("%s", message);
+      break;
+    case KURT_LOG_FATAL:
+      ROS_FATAL("%s", message);
+      break;
   }
-  else
-  {
-    //nav_msgs::Odometry has a 6x6 covariance matrix
-    msg.twist.covariance[0] = odom_multiplier * pow(sigma_x_, 2);
-    msg.twist.covariance[35] = odom_multiplier * pow(sigma_theta_, 2);
-
-    msg.twist.covariance[30] = odom_multiplier * cov_x_theta_;
-    msg.twist.covariance[5] = odom_multiplier * cov_x_theta_;
-  }
-
-  msg.twist.covariance[7] = DBL_MAX;
-  msg.twist.covariance[14] = DBL_MAX;
-  msg.twist.covariance[21] = DBL_MAX;
-  msg.twist.covariance[28] = DBL_MAX;
-
-  msg.pose.covariance = msg.twist.covariance;
-
-  if (fabs(v_encoder) <= 1e-8 && fabs(v_encoder_angular) <= 1e-8)
-  {
-    msg.pose.covariance[7] = 1e-12;
-
-    msg.pose.covariance[1] = 1e-12;
-    msg.pose.covariance[6] = 1e-12;
-
-    msg.pose.covariance[31] = 1e-12;
-    msg.pose.covariance[11] = 1e-12;
-  }
-  else
-  {
-    msg.pose.covariance[7] = odom_multiplier * pow(sigma_x_, 2) * pow(sigma_theta_, 2);
-
-    msg.pose.covariance[1] = odom_multiplier * cov_x_y_;
-    msg.pose.covariance[6] = odom_multiplier * cov_x_y_;
-
-    msg.pose.covariance[31] = odom_multiplier * cov_y_theta_;
-    msg.pose.covariance[11] = odom_multiplier * cov_y_theta_;
-  }
-}
-
-void ROSComm::send_odometry(double z, double x, double theta, double v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right)
-{
-  nav_msgs::Odometry odom;
-  odom.header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
-  odom.child_frame_id = tf::resolve(tf_prefix_, "base_footprint");
-
-  odom.header.stamp = ros::Time::now();
-  odom.pose.pose.position.x = z;
-  odom.pose.pose.position.y = -x;
-  odom.pose.pose.position.z = 0.0;
-  odom.pose.pose.orientation = tf::createQuaternionMsgFromYaw(-theta);
-
-  odom.twist.twist.linear.x = v_encoder;
-  odom.twist.twist.linear.y = 0.0;
-  odom.twist.twist.angular.z = v_encoder_angular;
-  populateCovariance(odom, v_encoder, v_encoder_angular);
-
-  odom_pub_.publish(odom);
-
-  if (publish_tf_)
-  {
-    geometry_msgs::TransformStamped odom_trans;
-    odom_trans.header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
-    odom_trans.child_frame_id = tf::resolve(tf_prefix_, "base_footprint");
-
-    odom_trans.header.stamp = ros::Time::now();
-    odom_trans.transform.translation.x = z;
-    odom_trans.transform.translation.y = -x;
-    odom_trans.transform.translation.z = 0.0;
-    odom_trans.transform.rotation = tf::createQuaternionMsgFromYaw(-theta);
-
-    odom_broadcaster_.sendTransform(odom_trans);
-  }
-
-  sensor_msgs::JointState joint_state;
-  joint_state.header.stamp = ros::Time::now();
-  joint_state.name.resize(6);
-  joint_state.position.resize(6);
-  joint_state.name[0] = "left_front_wheel_joint";
-  joint_state.name[1] = "left_middle_wheel_joint";
-  joint_state.name[2] = "left_rear_wheel_joint";
-  joint_state.name[3] = "right_front_wheel_joint";
-  joint_state.name[4] = "right_middle_wheel_joint";
-  joint_state.name[5] = "right_rear_wheel_joint";
-
-  static double wheelpos_l = 0;
-  wheelpos_l += 2.0 * M_PI * wheel_a / ticks_per_turn_of_wheel_;
-  if (wheelpos_l > M_PI)
-    wheelpos_l -= 2.0 * M_PI;
-  if (wheelpos_l < -M_PI)
-    wheelpos_l += 2.0 * M_PI;
-
-  static double wheelpos_r = 0;
-  wheelpos_r += 2 * M_PI * wheel_b / ticks_per_turn_of_wheel_;
-  if (wheelpos_r > M_PI)
-    wheelpos_r -= 2.0 * M_PI;
-  if (wheelpos_r < -M_PI)
-    wheelpos_r += 2.0 * M_PI;
-
-  joint_state.position[0] = joint_state.position[1] = joint_state.position[2] = wheelpos_l;
-  joint_state.position[3] = joint_state.position[4] = joint_state.position[5] = wheelpos_r;
-
-  // note: we reuse joint_state here, i.e., we modify joint_state after publishing.
-  // this is only safe as long as nothing in the same process subscribes to the
-  // joint_states topic. same for imu above.
-  joint_pub_.publish(joint_state);
-}
-
-void ROSComm::send_sonar_leftBack(int ir_left_back)
-{
-  sensor_msgs::Range range;
-  range.header.stamp = ros::Time::now();
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_left_back");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_left_back / 100.0;
-  range_pub_.publish(range);
-}
-
-void ROSComm::send_sonar_front_usound_leftFront_left(int ir_right_front, int usound, int ir_left_front, int ir_left)
-{
-  sensor_msgs::Range range;
-  range.header.stamp = ros::Time::now();
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_right_front");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_right_front / 100.0;
-  range_pub_.publish(range);
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ultrasound_front");
-  range.radiation_type = sensor_msgs::Range::ULTRASOUND;
-  range.field_of_view = SONAR_FOV;
-  range.min_range = SONAR_MIN;
-  range.max_range = SONAR_MAX;
-  range.range = usound / 100.0;
-  range_pub_.publish(range);
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_left_front");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_left_front / 100.0;
-  range_pub_.publish(range);
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_left");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_left / 100.0;
-  range_pub_.publish(range);
-}
-
-void ROSComm::send_sonar_back_rightBack_rightFront(int ir_back, int ir_right_back, int ir_right)
-{
-  sensor_msgs::Range range;
-  range.header.stamp = ros::Time::now();
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_back");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_back / 100.0;
-  range_pub_.publish(range);
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_right_back");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_right_back / 100.0;
-  range_pub_.publish(range);
-
-  range.header.frame_id = tf::resolve(tf_prefix_, "ir_right");
-  range.radiation_type = sensor_msgs::Range::INFRARED;
-  range.field_of_view = IR_FOV;
-  range.min_range = IR_MIN;
-  range.max_range = IR_MAX;
-  range.range = ir_right / 100.0;
-  range_pub_.publish(range);
-}
-
-void ROSComm::send_pitch_roll(double pitch, double roll)
-{
-  //TODO
 }
 
-void ROSComm::send_gyro(double theta, double sigma)
+KurtBase::KurtBase(const ros::NodeHandle &n, const ros::NodeHandle &nh_ns) :
+  n_(n),
+  nh_ns_(nh_ns)
 {
-  sensor_msgs::Imu imu;
-
-  // this is intentionally base_link (the location of the imu) and not base_footprint,
-  // but because they are connected by a fixed link, it doesn't matter
-  imu.header.frame_id = tf::resolve(tf_prefix_, "base_link");
-  imu.header.stamp = ros::Time::now();
-
-  imu.angular_velocity_covariance[0] = -1; // no data avilable, see Imu.msg
-  imu.linear_acceleration_covariance[0] = -1;
-
-  imu.orientation = tf::createQuaternionMsgFromYaw(theta);
-  imu.orientation_covariance[0] = sigma;
-  imu.orientation_covariance[4] = sigma;
-  imu.orientation_covariance[8] = sigma;
-  imu_pub_.publish(imu);
 }
 
-void ROSComm::send_rotunit(double rot)
+bool KurtBase::init()
 {
-  sensor_msgs::JointState joint_state;
-  joint_state.header.stamp = ros::Time::now();
-  joint_state.name.resize(1);
-  joint_state.position.resize(1);
-  joint_state.name[0] = "laser_rot_joint";
-  joint_state.position[0] = rot;
+  setKurtLogHandler(ros_log);
 
-  joint_pub_.publish(joint_state);
-}
-
-class ROSCall
-{
-  public:
-    ROSCall(Kurt &kurt, double axis_length) :
-      kurt_(kurt),
-      axis_length_(axis_length),
-      v_l_soll_(0.0),
-      v_r_soll_(0.0),
-      AntiWindup_(1.0),
-      last_cmd_vel_time_(0.0) { }
-    void velCallback(const geometry_msgs::Twist::ConstPtr& msg);
-    void pidCallback(const ros::TimerEvent& event);
-    void rotunitCallback(const geometry_msgs::Twist::ConstPtr& msg);
+  //Odometry parameter (defaults for kurt2 indoor)
+  double wheel_perimeter;
+  nh_ns_.param("wheel_perimeter", wheel_perimeter, 0.379);
+  double axis_length;
+  nh_ns_.param("axis_length", axis_length, 0.28);
 
-  private:
-    Kurt &kurt_;
-    double axis_length_;
-    double v_l_soll_;
-    double v_r_soll_;
-    double AntiWindup_;
-    ros::Time last_cmd_vel_time_;
-};
+  double turning_adaptation;
+  nh_ns_.param("turning_adaptation", turning_adaptation, 0.69);
+  int ticks_per_turn_of_wheel;
+  nh_ns_.param("ticks_per_turn_of_wheel", ticks_per_turn_of_wheel, 21950);
 
-void ROSCall::velCallback(const geometry_msgs::Twist::ConstPtr& msg)
-{
-  AntiWindup_ = 1.0;
-  last_cmd_vel_time_ = ros::Time::now();
-  v_l_soll_ = msg->linear.x - axis_length_ * msg->angular.z /*/ wheelRadius*/;
-  v_r_soll_ = msg->linear.x + axis_length_ * msg->angular.z/*/wheelRadius*/;
+  roscomm_.reset(new ROSComm(n_, ticks_per_turn_of_wheel));
+  kurt_.reset(new Kurt(*roscomm_, can_, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel));
 
-  if (msg->linear.x == 0 && msg->angular.z == 0)
+  // learn the turning adaptation on the current floor from the gyro
+  bool estimate_turning_adaptation;
+  nh_ns_.param("estimate_turning_adaptation", estimate_turning_adaptation, false);
+  if (estimate_turning_adaptation)
   {
-    AntiWindup_ = 0.0;
+    double slip_forgetting, slip_window, slip_min_turn;
+    nh_ns_.param("slip_forgetting", slip_forgetting, 0.995);
+    nh_ns_.param("slip_window", slip_window, 0.1);
+    nh_ns_.param("slip_min_turn", slip_min_turn, 0.01);
+    kurt_->setSlipEstimation(slip_forgetting, slip_window, slip_min_turn);
   }
-}
 
-void ROSCall::pidCallback(const ros::TimerEvent& event)
-{
-  double v_l_soll = 0.0;
-  double v_r_soll = 0.0;
-  double AntiWindup = 1.0;
-
-  if (ros::Time::now() - last_cmd_vel_time_ < ros::Duration(0.6))
+  // health of the micro controller on /diagnostics
+  double diagnostics_period, max_motor_current, max_board_temperature, mcu_cycle_tolerance, motor_voltage;
+  nh_ns_.param("diagnostics_period", diagnostics_period, 1.0);
+  nh_ns_.param("max_motor_current", max_motor_current, 10.0);
+  nh_ns_.param("max_board_temperature", max_board_temperature, 70.0);
+  nh_ns_.param("mcu_cycle_tolerance", mcu_cycle_tolerance, 0.1);
+  nh_ns_.param("motor_voltage", motor_voltage, 24.0);
+  kurt_->setMcuMonitor(diagnostics_period, max_motor_current, max_board_temperature, mcu_cycle_tolerance, motor_voltage);
+
+  // integrate the odometry on the host, take the one of the micro
+  // controller or check them against each other
+  std::string odometry_source;
+  nh_ns_.param("odometry_source", odometry_source, std::string("host"));
+  double odometry_check_period, odometry_max_error, odometry_max_relative_error, odometry_max_yaw_error;
+  nh_ns_.param("odometry_check_period", odometry_check_period, 1.0);
+  nh_ns_.param("odometry_max_error", odometry_max_error, 0.02);
+  nh_ns_.param("odometry_max_relative_error", odometry_max_relative_error, 0.05);
+  nh_ns_.param("odometry_max_yaw_error", odometry_max_yaw_error, 0.05);
+  OdometrySource source;
+  if (odometry_source == "host")
+    source = ODOMETRY_HOST;
+  else if (odometry_source == "mcu")
+    source = ODOMETRY_MCU;
+  else if (odometry_source == "both")
+    source = ODOMETRY_BOTH;
+  else
   {
-    v_l_soll = v_l_soll_;
-    v_r_soll = v_r_soll_;
-    AntiWindup = AntiWindup_;
+    ROS_FATAL("unknown odometry_source %s (host, mcu or both)", odometry_source.c_str());
+    return false;
   }
+  kurt_->setOdometrySource(source, odometry_check_period, odometry_max_error,
+      odometry_max_relative_error, odometry_max_yaw_error);
 
-  kurt_.set_wheel_speed(v_l_soll, v_r_soll, AntiWindup);
-}
-
-void ROSCall::rotunitCallback(const geometry_msgs::Twist::ConstPtr& msg)
-{
-    kurt_.can_rotunit_send(msg->angular.z);
-}
-
-int main(int argc, char** argv)
-{
-  ros::init(argc, argv, "kurt_base");
-  ros::NodeHandle n;
-  ros::NodeHandle nh_ns("~");
-
-  //Odometry parameter (defaults for kurt2 indoor)
-  double wheel_perimeter;
-  nh_ns.param("wheel_perimeter", wheel_perimeter, 0.379);
-  double axis_length;
-  nh_ns.param("axis_length", axis_length, 0.28);
-
-  double turning_adaptation;
-  nh_ns.param("turning_adaptation", turning_adaptation, 0.69);
-  int ticks_per_turn_of_wheel;
-  nh_ns.param("ticks_per_turn_of_wheel", ticks_per_turn_of_wheel, 21950);
-
-  double sigma_x, sigma_theta, cov_x_y, cov_x_theta, cov_y_theta;
-  nh_ns.param("x_stddev", sigma_x, 0.002);
-  nh_ns.param("rotation_stddev", sigma_theta, 0.017);
-  nh_ns.param("cov_xy", cov_x_y, 0.0);
-  nh_ns.param("cov_xrotation", cov_x_theta, 0.0);
-  nh_ns.param("cov_yrotation", cov_y_theta, 0.0);
-
-  ROSComm roscomm(n, sigma_x, sigma_theta, cov_x_y, cov_x_theta, cov_y_theta, ticks_per_turn_of_wheel);
+  // near field occupancy grid of the IR and sonar ranges
+  bool use_local_grid;
+  nh_ns_.param("use_local_grid", use_local_grid, false);
+  if (use_local_grid)
+  {
+    double local_grid_resolution, local_grid_publish_period;
+    nh_ns_.param("local_grid_resolution", local_grid_resolution, 0.05);
+    nh_ns_.param("local_grid_publish_period", local_grid_publish_period, 0.5);
+    kurt_->setLocalGrid(local_grid_resolution, local_grid_publish_period);
+  }
 
-  Kurt kurt(roscomm, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
+  // odometry covariance, the variance of each wheel grows with its distance
+  double wheel_noise;
+  nh_ns_.param("wheel_noise", wheel_noise, 0.01);
+  kurt_->setWheelNoise(wheel_noise);
+  // the fixed covariance parameters are replaced by wheel_noise
+  static const char *removed_covariance[] = { "x_stddev", "rotation_stddev", "cov_xy", "cov_xrotation", "cov_yrotation" };
+  for (size_t i = 0; i < sizeof(removed_covariance) / sizeof(removed_covariance[0]); i++)
+    if (nh_ns_.hasParam(removed_covariance[i]))
+      ROS_WARN("parameter %s is no longer used, the odometry covariance follows from wheel_noise",
+          removed_covariance[i]);
 
   //PID parameter (disables micro controller)
   std::string speedPwmLeerlaufTable;
-  if (nh_ns.getParam("speedtable", speedPwmLeerlaufTable))
+  if (nh_ns_.getParam("speedtable", speedPwmLeerlaufTable))
   {
     double feedforward_turn;
-    nh_ns.param("feedforward_turn", feedforward_turn, 0.35);
+    nh_ns_.param("feedforward_turn", feedforward_turn, 0.35);
     double ki, kp;
-    nh_ns.param("ki", ki, 3.4);
-    nh_ns.param("kp", kp, 0.4);
-    if (!kurt.setPWMData(speedPwmLeerlaufTable, feedforward_turn, ki, kp))
-      return 1;
+    nh_ns_.param("ki", ki, 3.4);
+    nh_ns_.param("kp", kp, 0.4);
+    if (!kurt_->setPWMData(speedPwmLeerlaufTable, feedforward_turn, ki, kp))
+      return false;
+
+    // smoothing of the encoder speeds: moving_average, median, ema or kalman
+    std::string velocity_filter;
+    nh_ns_.param("velocity_filter", velocity_filter, std::string("moving_average"));
+    int velocity_filter_window;
+    nh_ns_.param("velocity_filter_window", velocity_filter_window, 4);
+    double velocity_filter_alpha, velocity_filter_process_noise, velocity_filter_measurement_noise;
+    nh_ns_.param("velocity_filter_alpha", velocity_filter_alpha, 0.5);
+    nh_ns_.param("velocity_filter_process_noise", velocity_filter_process_noise, 10.0);
+    nh_ns_.param("velocity_filter_measurement_noise", velocity_filter_measurement_noise, 0.0004);
+    double max_velocity_jump;
+    nh_ns_.param("max_velocity_jump", max_velocity_jump, 0.19);
+    if (!kurt_->setVelocityFilter(velocity_filter, velocity_filter_window, velocity_filter_alpha,
+          velocity_filter_process_noise, velocity_filter_measurement_noise, max_velocity_jump))
+      return false;
+
+    // speed dependent gains per wheel, replace ki and kp
+    std::string gainTable;
+    if (nh_ns_.getParam("gaintable", gainTable) && !kurt_->setGainTable(gainTable))
+      return false;
+
+    // adapt the speedtable while driving and save it to learned_speedtable
+    std::string learnedTable;
+    if (nh_ns_.getParam("learned_speedtable", learnedTable))
+    {
+      double learn_rate, learn_max_step, learn_save_period;
+      int learn_width;
+      nh_ns_.param("learn_rate", learn_rate, 0.2);
+      nh_ns_.param("learn_max_step", learn_max_step, 2.0);
+      nh_ns_.param("learn_width", learn_width, 20);
+      nh_ns_.param("learn_save_period", learn_save_period, 60.0);
+      kurt_->setFeedforwardLearning(learnedTable, learn_rate, learn_max_step, learn_width, learn_save_period);
+    }
   }
 
+  // brake on the CAN receive path when one of these bits is set, released by
+  // a zero cmd_vel once the contact is gone. Off by default, the bits depend
+  // on the wiring (bit n of the bumper topic is bumper contact n)
+  int bumper_mask, remote_control_mask;
+  nh_ns_.param("bumper_mask", bumper_mask, 0x00);
+  nh_ns_.param("remote_control_stop_mask", remote_control_mask, 0x00);
+  kurt_->setBumperStop(bumper_mask, remote_control_mask);
+
+  // roll and pitch from the tilt sensor, carried along by the gyro
+  double tilt_time_constant, tilt_max_acceleration, tilt_stddev;
+  nh_ns_.param("tilt_time_constant", tilt_time_constant, 1.0);
+  nh_ns_.param("tilt_max_acceleration", tilt_max_acceleration, 1.0);
+  nh_ns_.param("tilt_stddev", tilt_stddev, 0.02);
+  kurt_->setOrientationFilter(tilt_time_constant, tilt_max_acceleration, tilt_stddev);
+
+  // gyro drift, learned while the robot is standing (replaces imu_recalibration)
+  double gyro_max_drift, gyro_bias_time_constant;
+  nh_ns_.param("gyro_max_drift", gyro_max_drift, 2.0 * M_PI / 120.0);
+  nh_ns_.param("gyro_bias_time_constant", gyro_bias_time_constant, 10.0);
+  kurt_->setGyroBiasEstimation(gyro_max_drift, gyro_bias_time_constant);
+
   bool use_rotunit;
-  nh_ns.param("use_rotunit", use_rotunit, false);
+  nh_ns_.param("use_rotunit", use_rotunit, false);
   if (use_rotunit) {
     double rotunit_speed;
-    nh_ns.param("rotunit_speed", rotunit_speed, M_PI/6.0);
-    kurt.can_rotunit_send(rotunit_speed);
+    nh_ns_.param("rotunit_speed", rotunit_speed, M_PI/6.0);
+
+    // trim the open loop rotunit speed from the measured angles
+    bool rotunit_closed_loop;
+    nh_ns_.param("rotunit_closed_loop", rotunit_closed_loop, false);
+    if (rotunit_closed_loop)
+    {
+      double rotunit_kp, rotunit_ki, rotunit_period;
+      nh_ns_.param("rotunit_kp", rotunit_kp, 0.5);
+      nh_ns_.param("rotunit_ki", rotunit_ki, 0.5);
+      nh_ns_.param("rotunit_control_period", rotunit_period, 0.5);
+      kurt_->setRotunitControl(rotunit_kp, rotunit_ki, rotunit_period);
+    }
+
+    kurt_->can_rotunit_send(rotunit_speed);
   }
 
   bool publish_tf;
-  nh_ns.param("publish_tf", publish_tf, false);
+  nh_ns_.param("publish_tf", publish_tf, false);
   std::string tf_prefix;
-  tf_prefix = tf::getPrefixParam(nh_ns);
-  roscomm.setTFPrefix(tf_prefix);
+  tf_prefix = tf::getPrefixParam(nh_ns_);
+  roscomm_->setTFPrefix(tf_prefix);
 
-  ROSCall roscall(kurt, axis_length);
+  // fuse odometry and gyro at encoder rate (replaces robot_pose_ekf)
+  bool use_ekf;
+  nh_ns_.param("use_ekf", use_ekf, false);
+  if (use_ekf)
+  {
+    double ekf_distance_noise, ekf_turn_noise, ekf_gyro_stddev;
+    nh_ns_.param("ekf_distance_noise", ekf_distance_noise, 0.05);
+    nh_ns_.param("ekf_turn_noise", ekf_turn_noise, 0.3);
+    nh_ns_.param("ekf_gyro_stddev", ekf_gyro_stddev, 0.01);
+    kurt_->setOdometryEKF(ekf_distance_noise, ekf_turn_noise, ekf_gyro_stddev);
+  }
+  roscomm_->setPublishTF(publish_tf || use_ekf, use_ekf);
 
-  ros::Timer pid_timer = n.createTimer(ros::Duration(0.01), &ROSCall::pidCallback, &roscall);
-  ros::Subscriber cmd_vel_sub = n.subscribe("cmd_vel", 10, &ROSCall::velCallback, &roscall);
-  ros::Subscriber rot_vel_sub;
-  if (use_rotunit)
-    rot_vel_sub = n.subscribe("rot_vel", 10, &ROSCall::rotunitCallback, &roscall);
+  roscall_.reset(new ROSCall(*kurt_, axis_length));
+
+  // acceleration and jerk limited setpoints (per robot limits), allows to
+  // enable the AntiWindup of the micro controller
+  bool use_velocity_profile;
+  nh_ns_.param("use_velocity_profile", use_velocity_profile, false);
+  if (use_velocity_profile)
+  {
+    double max_acc_lin, max_jerk_lin, max_acc_ang, max_jerk_ang;
+    nh_ns_.param("max_acc_lin", max_acc_lin, 0.5);
+    nh_ns_.param("max_jerk_lin", max_jerk_lin, 2.0);
+    nh_ns_.param("max_acc_ang", max_acc_ang, 1.5);
+    nh_ns_.param("max_jerk_ang", max_jerk_ang, 6.0);
+    roscall_->setVelocityProfile(max_acc_lin, max_jerk_lin, max_acc_ang, max_jerk_ang);
+    kurt_->setMCAntiWindup(true);
+  }
 
-  while (ros::ok())
+  // stops the robot independent of the spin loop (hard brake). The rx
+  // timeout is longer than a blocking CAN receive, so the reconnect runs
+  // first. The command timeout waits for the cmd_vel timeout and the ramp
+  // down of the velocity profiles from max_vel_lin and max_vel_ang.
+  bool use_watchdog;
+  nh_ns_.param("use_watchdog", use_watchdog, false);
+  if (use_watchdog)
   {
-    kurt.can_read_fifo();
-    ros::spinOnce();
+    double max_vel_lin, max_vel_ang;
+    nh_ns_.param("max_vel_lin", max_vel_lin, 1.0);
+    nh_ns_.param("max_vel_ang", max_vel_ang, M_PI);
+    double min_command_timeout = CMD_VEL_TIMEOUT + roscall_->stopTime(max_vel_lin, max_vel_ang) + 0.5;
+
+    double command_timeout, rx_timeout, control_deadline, watchdog_period;
+    nh_ns_.param("watchdog_command_timeout", command_timeout, min_command_timeout);
+    nh_ns_.param("watchdog_rx_timeout", rx_timeout, CAN_RECEIVE_TIMEOUT + 0.5);
+    nh_ns_.param("watchdog_control_deadline", control_deadline, 0.5);
+    nh_ns_.param("watchdog_period", watchdog_period, 0.01);
+    if (command_timeout > 0.0 && command_timeout < min_command_timeout)
+    {
+      ROS_WARN("watchdog_command_timeout %.2f s would brake before the robot stopped on its own, using %.2f s",
+          command_timeout, min_command_timeout);
+      command_timeout = min_command_timeout;
+    }
+    kurt_->startWatchdog(command_timeout, rx_timeout, control_deadline, watchdog_period);
   }
 
-  return 0;
+  pid_timer_ = n_.createTimer(ros::Duration(0.01), &ROSCall::pidCallback, roscall_.get());
+  cmd_vel_sub_ = n_.subscribe("cmd_vel", 10, &ROSCall::velCallback, roscall_.get());
+  if (use_rotunit)
+    rot_vel_sub_ = n_.subscribe("rot_vel", 10, &ROSCall::rotunitCallback, roscall_.get());
+
+  return true;
 }
@@ -0,0 +1,22 @@
+#include <ros/ros.h>
+
+#include "kurt_base.h"
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "kurt_base");
+  ros::NodeHandle n;
+  ros::NodeHandle nh_ns("~");
+
+  KurtBase kurt_base(n, nh_ns);
+  if (!kurt_base.init())
+    return 1;
+
+  while (ros::ok())
+  {
+    kurt_base.read();
+    ros::spinOnce();
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/callback_queue.h>
+
+#include "kurt_base.h"
+
+namespace kurt_base
+{
+
+/**
+ * kurt_base in a nodelet manager: consumers in the same manager get the
+ * odometry, IMU, range and joint state messages without serialization.
+ *
+ * As in the node, a single thread reads the CAN bus and serves the timer and
+ * subscriptions of the driver, which have their own callback queue and do
+ * not run in the worker threads of the manager.
+ */
+class KurtBaseNodelet : public nodelet::Nodelet
+{
+  public:
+    KurtBaseNodelet() : running_(false) { }
+    ~KurtBaseNodelet();
+
+  private:
+    virtual void onInit();
+    void spin();
+
+    ros::CallbackQueue queue_;
+    boost::scoped_ptr<KurtBase> kurt_base_;
+    volatile bool running_;
+    boost::thread thread_;
+};
+
+KurtBaseNodelet::~KurtBaseNodelet()
+{
+  running_ = false;
+  thread_.join();
+}
+
+void KurtBaseNodelet::onInit()
+{
+  ros::NodeHandle n(getNodeHandle());
+  n.setCallbackQueue(&queue_);
+
+  kurt_base_.reset(new KurtBase(n, getPrivateNodeHandle()));
+  if (!kurt_base_->init())
+  {
+    NODELET_FATAL("kurt_base: invalid parameters, not started");
+    kurt_base_.reset();
+    return;
+  }
+
+  running_ = true;
+  thread_ = boost::thread(boost::bind(&KurtBaseNodelet::spin, this));
+}
+
+void KurtBaseNodelet::spin()
+{
+  while (running_ && ros::ok())
+  {
+    kurt_base_->read();
+    queue_.callAvailable();
+  }
+}
+
+}
+
+PLUGINLIB_EXPORT_CLASS(kurt_base::KurtBaseNodelet, nodelet::Nodelet)
@@ -0,0 +1,10 @@
+#include <ctime>
+
+#include "kurt_clock.h"
+
+double monotonic_seconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,45 @@
+#include <cstdarg>
+#include <cstdio>
+
+#include <boost/thread/mutex.hpp>
+
+#include "kurt_clock.h"
+#include "kurt_log.h"
+
+static KurtLogHandler log_handler = NULL;
+// the throttle state is shared by all Kurt instances, e.g. in gainsweep
+static boost::mutex throttle_mutex;
+
+void setKurtLogHandler(KurtLogHandler handler)
+{
+  log_handler = handler;
+}
+
+void kurt_log(KurtLogLevel level, const char *format, ...)
+{
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  if (log_handler)
+  {
+    log_handler(level, message);
+    return;
+  }
+
+  static const char *names[] = { "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+  if (level != KURT_LOG_DEBUG)
+    fprintf(stderr, "[%s] %s\n", names[level], message);
+}
+
+bool kurt_log_throttle(double &last, double period)
+{
+  double now = monotonic_seconds();
+  boost::mutex::scoped_lock lock(throttle_mutex);
+  if (now - last < period)
+    return false;
+  last = now;
+  return true;
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "kurt.h"
+#include "kurt_log.h"
+#include "kurt_sim.h"
+
+// the MC sends the encoder frames every 10 ms
+#define SIM_DT 0.01
+
+KurtSimulator::KurtSimulator(double wheel_perimeter, int ticks_per_turn_of_wheel,
+    double tau, double load, double encoder_noise, unsigned int seed) :
+  wheel_perimeter_(wheel_perimeter),
+  ticks_per_turn_of_wheel_(ticks_per_turn_of_wheel),
+  tau_(std::max(tau, SIM_DT)),
+  load_(load),
+  encoder_noise_(encoder_noise),
+  seed_(seed),
+  time_(0.0)
+{
+  for (int wheel = 0; wheel < 2; wheel++)
+  {
+    pwm_[wheel] = 1023;
+    backward_[wheel] = false;
+    brake_[wheel] = false;
+    v_[wheel] = 0.0;
+    ticks_[wheel] = 0.0;
+  }
+}
+
+// same format as read by Kurt::setPWMData: t v vl vr pwm
+bool KurtSimulator::loadSpeedtable(const std::string &filename)
+{
+  FILE *fpr_fftable = fopen(filename.c_str(), "r");
+  if (fpr_fftable == NULL)
+  {
+    KURT_ERROR("KurtSimulator: Error opening speedtable %s", filename.c_str());
+    return false;
+  }
+
+  v_pwm_[0].assign(1025, 0.0);
+  v_pwm_[1].assign(1025, 0.0);
+  double t, v, vl, vr;
+  int pwm;
+  for (int i = 0; i < 1025; i++)
+  {
+    if (fscanf(fpr_fftable, "%lf %lf %lf %lf %d", &t, &v, &vl, &vr, &pwm) != 5 || pwm < 0 || pwm > 1024)
+    {
+      KURT_ERROR("KurtSimulator: Error reading speedtable %s", filename.c_str());
+      fclose(fpr_fftable);
+      return false;
+    }
+    v_pwm_[0][pwm] = vl;
+    v_pwm_[1][pwm] = vr;
+  }
+  fclose(fpr_fftable);
+  return true;
+}
+
+bool KurtSimulator::send_frame(const can_frame *frame)
+{
+  // only the RAW control mode drives the simulated motors, anything else
+  // (rotunit) is accepted and ignored
+  if (frame->can_id != CAN_CONTROL || frame->can_dlc != 8 || ((frame->data[0] << 8) | frame->data[1]) != RAW)
+    return true;
+
+  for (int wheel = 0; wheel < 2; wheel++)
+  {
+    const unsigned char *data = &frame->data[2 + 3 * wheel];
+    backward_[wheel] = (data[0] >> 1) & 1;
+    brake_[wheel] = data[0] & 1;
+    pwm_[wheel] = std::max(0, std::min(1023, (data[1] << 8) | data[2]));
+  }
+  return true;
+}
+
+double KurtSimulator::steadyStateSpeed(int wheel) const
+{
+  if (brake_[wheel] || v_pwm_[wheel].empty())
+    return 0.0;
+  double v = v_pwm_[wheel][1024 - pwm_[wheel]] * load_;
+  return backward_[wheel] ? -v : v;
+}
+
+// Box-Muller
+double KurtSimulator::gaussian()
+{
+  double u1 = (rand_r(&seed_) + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand_r(&seed_) + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+bool KurtSimulator::receive_frame(can_frame *frame)
+{
+  int ticks[2];
+  for (int wheel = 0; wheel < 2; wheel++)
+  {
+    // exact discretisation of the first order lag, braking stops faster
+    double tau = brake_[wheel] ? tau_ * 0.25 : tau_;
+    double v_old = v_[wheel];
+    v_[wheel] += (steadyStateSpeed(wheel) - v_[wheel]) * (1.0 - exp(-SIM_DT / tau));
+
+    ticks_[wheel] += 0.5 * (v_old + v_[wheel]) * SIM_DT / wheel_perimeter_ * ticks_per_turn_of_wheel_;
+    if (encoder_noise_ > 0.0)
+      ticks_[wheel] += encoder_noise_ * gaussian();
+    ticks[wheel] = std::max(-32768, std::min(32767, (int)floor(ticks_[wheel] + 0.5)));
+    ticks_[wheel] -= ticks[wheel];
+  }
+  time_ += SIM_DT;
+
+  frame->can_id = CAN_ENCODER;
+  frame->can_dlc = 4;
+  frame->data[0] = (ticks[0] >> 8) & 0xff;
+  frame->data[1] = ticks[0] & 0xff;
+  frame->data[2] = (ticks[1] >> 8) & 0xff;
+  frame->data[3] = ticks[1] & 0xff;
+  return true;
+}
+
+StepResponse StepResponse::evaluate(const std::vector<double> &v, double v_soll, double dt)
+{
+  StepResponse response;
+  if (fabs(v_soll) < 1e-6 || v.empty())
+    return response;
+
+  // normalised to a positive unit step
+  double t10 = -1.0, t90 = -1.0, peak = 0.0;
+  for (size_t i = 0; i < v.size(); i++)
+  {
+    double y = v[i] / v_soll;
+    if (t10 < 0.0 && y >= 0.1)
+      t10 = i * dt;
+    if (t90 < 0.0 && y >= 0.9)
+      t90 = i * dt;
+    peak = std::max(peak, y);
+    response.iae += fabs(v_soll - v[i]) * dt;
+  }
+  if (t10 >= 0.0 && t90 >= 0.0)
+    response.rise_time = t90 - t10;
+  response.overshoot = std::max(0.0, peak - 1.0);
+
+  size_t last = std::min(v.size(), (size_t)(1.0 / dt + 0.5));
+  double sum = 0.0;
+  for (size_t i = v.size() - last; i < v.size(); i++)
+    sum += v[i];
+  response.steady_state_error = fabs(v_soll - sum / last);
+  return response;
+}
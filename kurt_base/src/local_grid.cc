@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "local_grid.h"
+
+#define LOCAL_GRID_MASK (LOCAL_GRID_SIZE - 1)
+
+LocalGrid::LocalGrid(double resolution) :
+  resolution_(resolution),
+  origin_x_(-LOCAL_GRID_SIZE / 2),
+  origin_y_(-LOCAL_GRID_SIZE / 2),
+  x_(0.0),
+  y_(0.0),
+  yaw_(0.0)
+{
+  memset(cells_, 0, sizeof(cells_));
+}
+
+int8_t *LocalGrid::cell(long i, long j)
+{
+  if (i < origin_x_ || i >= origin_x_ + LOCAL_GRID_SIZE || j < origin_y_ || j >= origin_y_ + LOCAL_GRID_SIZE)
+    return NULL;
+  return &cells_[(j & LOCAL_GRID_MASK) * LOCAL_GRID_SIZE + (i & LOCAL_GRID_MASK)];
+}
+
+const int8_t *LocalGrid::cell(long i, long j) const
+{
+  if (i < origin_x_ || i >= origin_x_ + LOCAL_GRID_SIZE || j < origin_y_ || j >= origin_y_ + LOCAL_GRID_SIZE)
+    return NULL;
+  return &cells_[(j & LOCAL_GRID_MASK) * LOCAL_GRID_SIZE + (i & LOCAL_GRID_MASK)];
+}
+
+void LocalGrid::update(int8_t *c, int delta)
+{
+  *c = std::max(-LOCAL_GRID_MAX, std::min(LOCAL_GRID_MAX, *c + delta));
+}
+
+// cells [from, to) that are new when the origin moves
+static void scrolled_in(long old_origin, long new_origin, long &from, long &to)
+{
+  if (new_origin > old_origin)
+  {
+    from = std::max(old_origin + LOCAL_GRID_SIZE, new_origin);
+    to = new_origin + LOCAL_GRID_SIZE;
+  }
+  else
+  {
+    from = new_origin;
+    to = std::min(old_origin, new_origin + LOCAL_GRID_SIZE);
+  }
+}
+
+void LocalGrid::move(double x, double y, double yaw)
+{
+  x_ = x;
+  y_ = y;
+  yaw_ = yaw;
+
+  // the robot stays in the center cell
+  long origin_x = (long)floor(x / resolution_) - LOCAL_GRID_SIZE / 2;
+  long origin_y = (long)floor(y / resolution_) - LOCAL_GRID_SIZE / 2;
+
+  // clear the columns and rows that scroll in
+  long from, to;
+  scrolled_in(origin_x_, origin_x, from, to);
+  if (to - from >= LOCAL_GRID_SIZE)
+    memset(cells_, 0, sizeof(cells_));
+  else
+    for (long i = from; i < to; i++)
+      for (int j = 0; j < LOCAL_GRID_SIZE; j++)
+        cells_[j * LOCAL_GRID_SIZE + (i & LOCAL_GRID_MASK)] = 0;
+  origin_x_ = origin_x;
+
+  scrolled_in(origin_y_, origin_y, from, to);
+  if (to - from >= LOCAL_GRID_SIZE)
+    memset(cells_, 0, sizeof(cells_));
+  else
+    for (long j = from; j < to; j++)
+      memset(&cells_[(j & LOCAL_GRID_MASK) * LOCAL_GRID_SIZE], 0, LOCAL_GRID_SIZE);
+  origin_y_ = origin_y;
+}
+
+void LocalGrid::insertRange(double x, double y, double yaw, double fov, double range, double max_range)
+{
+  // sensor in the odometry frame
+  double c = cos(yaw_), s = sin(yaw_);
+  double sensor_x = x_ + c * x - s * y;
+  double sensor_y = y_ + s * x + c * y;
+  double sensor_yaw = yaw_ + yaw;
+
+  bool hit = range < max_range;
+  range = std::min(range, max_range);
+  double reach = range + 0.5 * resolution_;
+
+  long i0 = (long)floor((sensor_x - reach) / resolution_);
+  long i1 = (long)floor((sensor_x + reach) / resolution_);
+  long j0 = (long)floor((sensor_y - reach) / resolution_);
+  long j1 = (long)floor((sensor_y + reach) / resolution_);
+  for (long j = j0; j <= j1; j++)
+  {
+    for (long i = i0; i <= i1; i++)
+    {
+      int8_t *cp = cell(i, j);
+      if (!cp)
+        continue;
+
+      double dx = (i + 0.5) * resolution_ - sensor_x;
+      double dy = (j + 0.5) * resolution_ - sensor_y;
+      double d = hypot(dx, dy);
+      if (d > reach)
+        continue;
+      // a narrow cone still covers the cells it passes through
+      double bearing = remainder(atan2(dy, dx) - sensor_yaw, 2.0 * M_PI);
+      if (fabs(bearing) > 0.5 * fov + atan2(0.5 * resolution_, d))
+        continue;
+
+      if (d < range - 0.5 * resolution_)
+        update(cp, LOCAL_GRID_FREE);
+      else if (hit)
+        update(cp, LOCAL_GRID_OCCUPIED);
+    }
+  }
+}
+
+int8_t LocalGrid::logOdds(double x, double y) const
+{
+  double c = cos(yaw_), s = sin(yaw_);
+  const int8_t *cp = cell((long)floor((x_ + c * x - s * y) / resolution_),
+      (long)floor((y_ + s * x + c * y) / resolution_));
+  return cp ? *cp : 0;
+}
+
+void LocalGrid::row(int j, int8_t *cells) const
+{
+  const int8_t *r = &cells_[((origin_y_ + j) & LOCAL_GRID_MASK) * LOCAL_GRID_SIZE];
+  for (int i = 0; i < LOCAL_GRID_SIZE; i++)
+    cells[i] = r[(origin_x_ + i) & LOCAL_GRID_MASK];
+}
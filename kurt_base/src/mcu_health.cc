@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "mcu_health.h"
+
+// warnings start at this fraction of the limits
+#define MCU_WARN_FRACTION 0.8
+
+McuMonitor::McuMonitor(double period, double max_current, double max_temperature,
+    double cycle_tolerance, double voltage) :
+  period_(period),
+  max_current_(max_current),
+  max_temperature_(max_temperature),
+  cycle_tolerance_(cycle_tolerance),
+  voltage_(voltage),
+  start_(-1.0),
+  loop_valid_(false),
+  first_loop_(0),
+  last_loop_(0),
+  first_loop_time_(0.0),
+  last_loop_time_(0.0),
+  adc_frames_(0),
+  sum_current_left_(0.0),
+  sum_current_right_(0.0),
+  peak_current_left_(0.0),
+  peak_current_right_(0.0)
+{
+  health_.level = MCU_OK;
+  health_.hw_id = 0;
+  health_.firmware_version = 0;
+  health_.cycle_time = 0.0;
+  health_.current_left = health_.current_right = 0.0;
+  health_.peak_current_left = health_.peak_current_right = 0.0;
+  health_.power_left = health_.power_right = 0.0;
+  health_.temperature = 0.0;
+}
+
+void McuMonitor::setParameters(double period, double max_current, double max_temperature,
+    double cycle_tolerance, double voltage)
+{
+  period_ = period;
+  max_current_ = max_current;
+  max_temperature_ = max_temperature;
+  cycle_tolerance_ = cycle_tolerance;
+  voltage_ = voltage;
+}
+
+void McuMonitor::info(int hw_id, int firmware_version, unsigned long loop, double time)
+{
+  if (start_ < 0.0)
+    start_ = time;
+  health_.hw_id = hw_id;
+  health_.firmware_version = firmware_version;
+
+  if (!loop_valid_)
+  {
+    first_loop_ = loop;
+    first_loop_time_ = time;
+    loop_valid_ = true;
+  }
+  last_loop_ = loop;
+  last_loop_time_ = time;
+}
+
+void McuMonitor::adc(double current_left, double current_right, double temperature)
+{
+  peak_current_left_ = std::max(peak_current_left_, current_left);
+  peak_current_right_ = std::max(peak_current_right_, current_right);
+  health_.temperature = temperature;
+  sum_current_left_ += current_left;
+  sum_current_right_ += current_right;
+  adc_frames_++;
+}
+
+static void check(McuHealth &health, double value, double limit, const char *what)
+{
+  int level = MCU_OK;
+  if (value > limit)
+    level = MCU_ERROR;
+  else if (value > MCU_WARN_FRACTION * limit)
+    level = MCU_WARN;
+  else
+    return;
+
+  health.level = std::max(health.level, level);
+  if (!health.message.empty())
+    health.message += ", ";
+  health.message += what;
+}
+
+const McuHealth &McuMonitor::health(double time)
+{
+  // the counter is 32 bit wide on the micro controller
+  unsigned long loops = (last_loop_ - first_loop_) & 0xffffffffUL;
+  health_.cycle_time = loops > 0 ? (last_loop_time_ - first_loop_time_) / loops : 0.0;
+
+  if (adc_frames_ > 0)
+  {
+    health_.current_left = sum_current_left_ / adc_frames_;
+    health_.current_right = sum_current_right_ / adc_frames_;
+  }
+  health_.peak_current_left = peak_current_left_;
+  health_.peak_current_right = peak_current_right_;
+  health_.power_left = health_.current_left * voltage_;
+  health_.power_right = health_.current_right * voltage_;
+
+  health_.level = MCU_OK;
+  health_.message.clear();
+  check(health_, health_.peak_current_left, max_current_, "left motor overload");
+  check(health_, health_.peak_current_right, max_current_, "right motor overload");
+  check(health_, health_.temperature, max_temperature_, "board overheating");
+  if (health_.cycle_time > MCU_CYCLE_TIME * (1.0 + cycle_tolerance_))
+  {
+    health_.level = std::max(health_.level, MCU_WARN);
+    if (!health_.message.empty())
+      health_.message += ", ";
+    health_.message += "control cycle too slow";
+  }
+  if (health_.message.empty())
+    health_.message = "ok";
+
+  // next period, the loop count continues from the last frame
+  start_ = time;
+  first_loop_ = last_loop_;
+  first_loop_time_ = last_loop_time_;
+  adc_frames_ = 0;
+  sum_current_left_ = sum_current_right_ = 0.0;
+  peak_current_left_ = peak_current_right_ = 0.0;
+  return health_;
+}
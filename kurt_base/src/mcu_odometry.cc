@@ -0,0 +1,146 @@
+#include <cmath>
+#include <cstdlib>
+
+#include <stdint.h>
+
+#include "mcu_odometry.h"
+
+static double normalize(double angle)
+{
+  return remainder(angle, 2.0 * M_PI);
+}
+
+// the counters of the micro controller are 32 bit wide
+static long difference32(long a, long b)
+{
+  return (int32_t)(uint32_t)(a - b);
+}
+
+McuOdometry::McuOdometry(double period, double max_error, double max_relative_error, double max_yaw_error) :
+  period_(period),
+  max_error_(max_error),
+  max_relative_error_(max_relative_error),
+  max_yaw_error_(max_yaw_error),
+  ticks_valid_(false),
+  pose_valid_(false),
+  rebase_(true),
+  x_(0.0),
+  y_(0.0),
+  yaw_(0.0),
+  offset_x_(0.0),
+  offset_y_(0.0),
+  offset_yaw_(0.0),
+  window_start_(-1.0),
+  distance_(0.0) { }
+
+void McuOdometry::setParameters(double period, double max_error, double max_relative_error, double max_yaw_error)
+{
+  period_ = period;
+  max_error_ = max_error;
+  max_relative_error_ = max_relative_error;
+  max_yaw_error_ = max_yaw_error;
+}
+
+void McuOdometry::restart()
+{
+  ticks_valid_ = false;
+  rebase_ = true;
+  window_start_ = -1.0;
+}
+
+bool McuOdometry::lostTicks(const long accumulated[2], const long received[2], long lost[2])
+{
+  lost[0] = lost[1] = 0;
+  if (!ticks_valid_)
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      base_accumulated_[i] = accumulated[i];
+      base_received_[i] = received[i];
+      last_difference_[i] = 0;
+    }
+    ticks_valid_ = true;
+    return false;
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    long difference = difference32(accumulated[i], base_accumulated_[i]) - (received[i] - base_received_[i]);
+    if ((difference > 0 && last_difference_[i] > 0) || (difference < 0 && last_difference_[i] < 0))
+      lost[i] = labs(difference) < labs(last_difference_[i]) ? difference : last_difference_[i];
+    // the lost ticks count as received from now on
+    base_received_[i] -= lost[i];
+    last_difference_[i] = difference - lost[i];
+  }
+  return lost[0] != 0 || lost[1] != 0;
+}
+
+void McuOdometry::setPose(double x, double y, double yaw)
+{
+  if (rebase_)
+  {
+    offset_yaw_ = normalize(yaw_ - yaw);
+    offset_x_ = x_ - (cos(offset_yaw_) * x - sin(offset_yaw_) * y);
+    offset_y_ = y_ - (sin(offset_yaw_) * x + cos(offset_yaw_) * y);
+    rebase_ = false;
+  }
+
+  double c = cos(offset_yaw_), s = sin(offset_yaw_);
+  x_ = offset_x_ + c * x - s * y;
+  y_ = offset_y_ + s * x + c * y;
+  yaw_ = normalize(offset_yaw_ + yaw);
+  pose_valid_ = true;
+}
+
+void McuOdometry::startWindow(double x, double y, double yaw, double time)
+{
+  window_start_ = time;
+  host_start_[0] = x;
+  host_start_[1] = y;
+  host_start_[2] = yaw;
+  mcu_start_[0] = x_;
+  mcu_start_[1] = y_;
+  mcu_start_[2] = yaw_;
+  distance_ = 0.0;
+  last_host_[0] = x;
+  last_host_[1] = y;
+}
+
+bool McuOdometry::check(double x, double y, double yaw, double time, double &position_error,
+    double &yaw_error, bool &consistent)
+{
+  if (!pose_valid_ || rebase_)
+    return false;
+
+  if (window_start_ < 0.0)
+  {
+    startWindow(x, y, yaw, time);
+    return false;
+  }
+
+  distance_ += hypot(x - last_host_[0], y - last_host_[1]);
+  last_host_[0] = x;
+  last_host_[1] = y;
+  if (time - window_start_ < period_)
+    return false;
+
+  // increments in the pose at the start of the window
+  double c = cos(host_start_[2]), s = sin(host_start_[2]);
+  double host_dx = c * (x - host_start_[0]) + s * (y - host_start_[1]);
+  double host_dy = -s * (x - host_start_[0]) + c * (y - host_start_[1]);
+  double host_dyaw = normalize(yaw - host_start_[2]);
+
+  c = cos(mcu_start_[2]);
+  s = sin(mcu_start_[2]);
+  double mcu_dx = c * (x_ - mcu_start_[0]) + s * (y_ - mcu_start_[1]);
+  double mcu_dy = -s * (x_ - mcu_start_[0]) + c * (y_ - mcu_start_[1]);
+  double mcu_dyaw = normalize(yaw_ - mcu_start_[2]);
+
+  position_error = hypot(host_dx - mcu_dx, host_dy - mcu_dy);
+  yaw_error = fabs(normalize(host_dyaw - mcu_dyaw));
+  consistent = position_error <= max_error_ + max_relative_error_ * distance_
+    && yaw_error <= max_yaw_error_;
+
+  startWindow(x, y, yaw, time);
+  return true;
+}
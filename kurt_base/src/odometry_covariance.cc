@@ -0,0 +1,67 @@
+#include <cmath>
+
+#include "odometry_covariance.h"
+
+OdometryCovariance::OdometryCovariance(double wheel_noise, double tick_length, double axis_length,
+    double turning_adaptation) :
+  wheel_noise_(wheel_noise),
+  tick_variance_(tick_length * tick_length / 12.0),
+  axis_length_(axis_length),
+  turning_adaptation_(turning_adaptation)
+{
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      pose_[i][j] = 0.0;
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      twist_[i][j] = 0.0;
+}
+
+void OdometryCovariance::update(double wheel_l, double wheel_r, double yaw, double dt)
+{
+  double c = turning_adaptation_ / axis_length_;
+  double distance = 0.5 * (wheel_l + wheel_r);
+  double heading = yaw + 0.5 * (wheel_r - wheel_l) * c;
+  double cs = cos(heading), sn = sin(heading);
+
+  // variances of the wheel distances
+  double Q[2] = {
+    wheel_noise_ * wheel_noise_ * fabs(wheel_l) + tick_variance_,
+    wheel_noise_ * wheel_noise_ * fabs(wheel_r) + tick_variance_ };
+
+  // jacobians with respect to the pose and to (wheel_l, wheel_r)
+  double F[3][3] = {
+    { 1.0, 0.0, -distance * sn },
+    { 0.0, 1.0, distance * cs },
+    { 0.0, 0.0, 1.0 } };
+  double G[3][2] = {
+    { 0.5 * cs + 0.5 * c * distance * sn, 0.5 * cs - 0.5 * c * distance * sn },
+    { 0.5 * sn - 0.5 * c * distance * cs, 0.5 * sn + 0.5 * c * distance * cs },
+    { -c, c } };
+
+  // P = F P F^T + G Q G^T
+  double FP[3][3];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+    {
+      FP[i][j] = 0.0;
+      for (int k = 0; k < 3; k++)
+        FP[i][j] += F[i][k] * pose_[k][j];
+    }
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+    {
+      double p = 0.0;
+      for (int k = 0; k < 3; k++)
+        p += FP[i][k] * F[j][k];
+      for (int k = 0; k < 2; k++)
+        p += G[i][k] * Q[k] * G[j][k];
+      pose_[i][j] = p;
+    }
+
+  // v = (l + r) / 2 / dt, omega = (r - l) * c / dt
+  double dt2 = dt * dt;
+  twist_[0][0] = 0.25 * (Q[0] + Q[1]) / dt2;
+  twist_[1][1] = c * c * (Q[0] + Q[1]) / dt2;
+  twist_[0][1] = twist_[1][0] = 0.5 * c * (Q[1] - Q[0]) / dt2;
+}
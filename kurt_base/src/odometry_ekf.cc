@@ -0,0 +1,99 @@
+#include <cmath>
+
+#include "odometry_ekf.h"
+
+static double normalize(double angle)
+{
+  return remainder(angle, 2.0 * M_PI);
+}
+
+OdometryEKF::OdometryEKF(double distance_noise, double turn_noise) :
+  distance_noise_(distance_noise),
+  turn_noise_(turn_noise),
+  yaw_offset_valid_(false),
+  yaw_offset_(0.0)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    x_[i] = 0.0;
+    for (int j = 0; j < 3; j++)
+      P_[i][j] = 0.0;
+  }
+}
+
+void OdometryEKF::setParameters(double distance_noise, double turn_noise)
+{
+  distance_noise_ = distance_noise;
+  turn_noise_ = turn_noise;
+}
+
+void OdometryEKF::predict(double distance, double turn)
+{
+  // move along the mean heading of the frame
+  double heading = x_[2] + 0.5 * turn;
+  double c = cos(heading), s = sin(heading);
+  x_[0] += distance * c;
+  x_[1] += distance * s;
+  x_[2] = normalize(x_[2] + turn);
+
+  // jacobians with respect to the state and to (distance, turn)
+  double F[3][3] = {
+    { 1.0, 0.0, -distance * s },
+    { 0.0, 1.0, distance * c },
+    { 0.0, 0.0, 1.0 } };
+  double G[3][2] = {
+    { c, -0.5 * distance * s },
+    { s, 0.5 * distance * c },
+    { 0.0, 1.0 } };
+  double sd = distance_noise_ * distance;
+  double st = turn_noise_ * turn;
+  double Q[2] = { sd * sd, st * st };
+
+  // P = F P F^T + G Q G^T
+  double FP[3][3];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+    {
+      FP[i][j] = 0.0;
+      for (int k = 0; k < 3; k++)
+        FP[i][j] += F[i][k] * P_[k][j];
+    }
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+    {
+      double p = 0.0;
+      for (int k = 0; k < 3; k++)
+        p += FP[i][k] * F[j][k];
+      for (int k = 0; k < 2; k++)
+        p += G[i][k] * Q[k] * G[j][k];
+      P_[i][j] = p;
+    }
+}
+
+void OdometryEKF::updateYaw(double yaw, double variance)
+{
+  if (!yaw_offset_valid_)
+  {
+    yaw_offset_ = normalize(x_[2] - yaw);
+    yaw_offset_valid_ = true;
+    return;
+  }
+
+  double innovation = normalize(yaw + yaw_offset_ - x_[2]);
+  double S = P_[2][2] + variance;
+  if (S <= 0.0)
+    return;
+
+  double K[3];
+  for (int i = 0; i < 3; i++)
+    K[i] = P_[i][2] / S;
+  for (int i = 0; i < 3; i++)
+    x_[i] += K[i] * innovation;
+  x_[2] = normalize(x_[2]);
+
+  // P = (I - K H) P with H = (0 0 1)
+  double P2[3] = { P_[2][0], P_[2][1], P_[2][2] };
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      P_[i][j] -= K[i] * P2[j];
+}
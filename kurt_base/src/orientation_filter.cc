@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cmath>
+
+#include "orientation_filter.h"
+
+OrientationFilter::OrientationFilter(double tau, double max_acceleration) :
+  tau_(tau),
+  max_acceleration_(max_acceleration),
+  tilt_valid_(false),
+  yaw_valid_(false),
+  roll_(0.0),
+  pitch_(0.0),
+  yaw_(0.0),
+  yaw_rate_(0.0) { }
+
+void OrientationFilter::setParameters(double tau, double max_acceleration)
+{
+  tau_ = tau;
+  max_acceleration_ = max_acceleration;
+}
+
+void OrientationFilter::updateTilt(double roll, double pitch, double acceleration, double dt)
+{
+  if (!tilt_valid_)
+  {
+    roll_ = roll;
+    pitch_ = pitch;
+    tilt_valid_ = true;
+    return;
+  }
+
+  double trust = max_acceleration_ > 0.0 ? std::max(0.0, 1.0 - fabs(acceleration) / max_acceleration_) : 1.0;
+  double k = trust * dt / (tau_ + dt);
+  roll_ += k * (roll - roll_);
+  pitch_ += k * (pitch - pitch_);
+}
+
+void OrientationFilter::updateYaw(double yaw, double dt)
+{
+  if (!yaw_valid_)
+  {
+    yaw_ = yaw;
+    yaw_valid_ = true;
+    return;
+  }
+
+  double dyaw = remainder(yaw - yaw_, 2.0 * M_PI);
+  yaw_ = yaw;
+  yaw_rate_ = dt > 0.0 ? dyaw / dt : 0.0;
+
+  // the slope stays, the robot turns on it
+  double c = cos(dyaw), s = sin(dyaw);
+  double pitch = pitch_ * c - roll_ * s;
+  double roll = pitch_ * s + roll_ * c;
+  pitch_ = pitch;
+  roll_ = roll;
+}
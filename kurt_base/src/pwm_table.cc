@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "pwm_table.h"
+
+void PwmTable::build(int nr, const double *v_pwm_l, const double *v_pwm_r, int nr_v)
+{
+  // both wheels have to reach the maximum speed
+  double v_max_l = 0.0, v_max_r = 0.0;
+  for (int i = 0; i < nr; i++)
+  {
+    v_max_l = std::max(v_max_l, v_pwm_l[i]);
+    v_max_r = std::max(v_max_r, v_pwm_r[i]);
+  }
+  vmax_ = std::min(v_max_l, v_max_r);
+  nr_knots_ = nr_v + 1;
+  knots_per_v_ = vmax_ > 0.0 ? nr_v / vmax_ : 0.0;
+  knots_.assign(2 * nr_knots_, 0.0);
+
+  const double *v_pwm[2] = {v_pwm_l, v_pwm_r};
+  std::vector<double> v(nr);
+  for (int wheel = 0; wheel < 2; wheel++)
+  {
+    // measured speed must be increasing with the pwm
+    double v_run = 0.0;
+    for (int p = 0; p < nr; p++)
+      v[p] = v_run = std::max(v_run, v_pwm[wheel][p]);
+
+    // invert by linear interpolation between the measured pwm values,
+    // knot 0 is pwm 0 for a stop
+    int p = 1;
+    for (int i = 1; i < nr_knots_; i++)
+    {
+      double v_knot = knotSpeed(i);
+      while (p < nr - 1 && v[p] < v_knot)
+        p++;
+      double t = v[p] > v[p - 1] ? (v_knot - v[p - 1]) / (v[p] - v[p - 1]) : 1.0;
+      knots_[2 * i + wheel] = p - 1 + std::max(0.0, std::min(1.0, t));
+    }
+  }
+}
+
+double PwmTable::speed(double pwm, int wheel) const
+{
+  if (nr_knots_ == 0 || pwm <= knots_[wheel])
+    return 0.0;
+  if (pwm >= knots_[2 * (nr_knots_ - 1) + wheel])
+    return vmax_;
+
+  // binary search for the last knot with a pwm below
+  int lo = 0, hi = nr_knots_ - 1;
+  while (hi - lo > 1)
+  {
+    int mid = (lo + hi) / 2;
+    if (knots_[2 * mid + wheel] < pwm)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  double p_lo = knots_[2 * lo + wheel], p_hi = knots_[2 * hi + wheel];
+  double t = p_hi > p_lo ? (pwm - p_lo) / (p_hi - p_lo) : 0.0;
+  return knotSpeed(lo) + t * (knotSpeed(hi) - knotSpeed(lo));
+}
+
+void PwmTable::makeMonotone(int i, int wheel)
+{
+  for (int j = i + 1; j < nr_knots_; j++)
+    knots_[2 * j + wheel] = std::max(knots_[2 * j + wheel], knots_[2 * (j - 1) + wheel]);
+  for (int j = i - 1; j >= 0; j--)
+    knots_[2 * j + wheel] = std::min(knots_[2 * j + wheel], knots_[2 * (j + 1) + wheel]);
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+
+#include "ros_call.h"
+
+void ROSCall::setVelocityProfile(double max_acc_lin, double max_jerk_lin, double max_acc_ang, double max_jerk_ang)
+{
+  v_profile_.reset(new VelocityProfile(max_acc_lin, max_jerk_lin));
+  omega_profile_.reset(new VelocityProfile(max_acc_ang, max_jerk_ang));
+}
+
+double ROSCall::stopTime(double v, double omega) const
+{
+  if (!v_profile_)
+    return 0.0;
+  return std::max(v_profile_->stopTime(v), omega_profile_->stopTime(omega));
+}
+
+void ROSCall::velCallback(const geometry_msgs::Twist::ConstPtr& msg)
+{
+  AntiWindup_ = 1.0;
+  last_cmd_vel_time_ = ros::Time::now();
+  v_l_soll_ = msg->linear.x - axis_length_ * msg->angular.z /*/ wheelRadius*/;
+  v_r_soll_ = msg->linear.x + axis_length_ * msg->angular.z/*/wheelRadius*/;
+  v_soll_ = msg->linear.x;
+  omega_soll_ = msg->angular.z;
+  kurt_.commandReceived(msg->linear.x != 0 || msg->angular.z != 0);
+
+  if (msg->linear.x == 0 && msg->angular.z == 0)
+  {
+    AntiWindup_ = 0.0;
+  }
+}
+
+void ROSCall::pidCallback(const ros::TimerEvent& event)
+{
+  double v_l_soll = 0.0;
+  double v_r_soll = 0.0;
+  double omega_soll = 0.0;
+  double AntiWindup = 1.0;
+
+  bool timeout = ros::Time::now() - last_cmd_vel_time_ >= ros::Duration(CMD_VEL_TIMEOUT);
+
+  if (v_profile_)
+  {
+    // the profile brings the robot to rest within its limits on a timeout,
+    // AntiWindup is only reset once it stands still
+    double dt = (event.current_real - event.last_real).toSec();
+    if (dt <= 0.0 || dt > 0.1)
+      dt = 0.01;
+    double v = v_profile_->update(timeout ? 0.0 : v_soll_, dt);
+    double omega = omega_profile_->update(timeout ? 0.0 : omega_soll_, dt);
+    v_l_soll = v - axis_length_ * omega;
+    v_r_soll = v + axis_length_ * omega;
+    omega_soll = omega;
+    if (v_profile_->atRest() && omega_profile_->atRest())
+      AntiWindup = 0.0;
+  }
+  else if (!timeout)
+  {
+    v_l_soll = v_l_soll_;
+    v_r_soll = v_r_soll_;
+    omega_soll = omega_soll_;
+    AntiWindup = AntiWindup_;
+  }
+
+  kurt_.set_wheel_speed(v_l_soll, v_r_soll, omega_soll, AntiWindup);
+}
+
+void ROSCall::rotunitCallback(const geometry_msgs::Twist::ConstPtr& msg)
+{
+    kurt_.can_rotunit_send(msg->angular.z);
+}
@@ -0,0 +1,377 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/JointState.h>
+#include <sensor_msgs/Range.h>
+#include <std_msgs/Bool.h>
+#include <std_msgs/Float64.h>
+#include <std_msgs/String.h>
+#include <std_msgs/UInt8.h>
+
+#include "kurt.h"
+#include "ros_comm.h"
+
+ROSComm::ROSComm(
+    const ros::NodeHandle &n,
+    int ticks_per_turn_of_wheel) :
+  n_(n),
+  ticks_per_turn_of_wheel_(ticks_per_turn_of_wheel),
+  publish_tf_(false),
+  fused_tf_(false),
+  wheelpos_l_(0.0),
+  wheelpos_r_(0.0),
+  odom_pub_(n_.advertise<nav_msgs::Odometry> ("odom", 10)),
+  range_pub_(n_.advertise<sensor_msgs::Range> ("range", 10)),
+  imu_pub_(n_.advertise<sensor_msgs::Imu> ("imu", 10)),
+  odom_combined_pub_(n_.advertise<geometry_msgs::PoseWithCovarianceStamped> ("odom_combined", 10)),
+  turning_adaptation_pub_(n_.advertise<std_msgs::Float64> ("turning_adaptation", 10)),
+  slip_pub_(n_.advertise<std_msgs::Float64> ("slip", 10)),
+  diagnostics_pub_(n_.advertise<diagnostic_msgs::DiagnosticArray> ("diagnostics", 10)),
+  local_grid_pub_(n_.advertise<nav_msgs::OccupancyGrid> ("local_grid", 1)),
+  joint_pub_(n_.advertise<sensor_msgs::JointState> ("joint_states", 1)),
+  bumper_pub_(n_.advertise<std_msgs::UInt8> ("bumper", 10)),
+  remote_control_pub_(n_.advertise<std_msgs::UInt8> ("remote_control", 10)),
+  bumper_stop_pub_(n_.advertise<std_msgs::Bool> ("bumper_stop", 10)),
+  watchdog_pub_(n_.advertise<std_msgs::String> ("watchdog", 10, true)),
+  can_available_pub_(n_.advertise<std_msgs::Bool> ("can_available", 10, true))
+{
+  send_can_available(false);
+}
+
+void ROSComm::setTFPrefix(const std::string &tf_prefix)
+{
+  tf_prefix_ = tf_prefix;
+}
+
+void ROSComm::setPublishTF(bool publish_tf, bool fused)
+{
+  publish_tf_ = publish_tf;
+  fused_tf_ = fused;
+}
+
+void ROSComm::populateCovariance(nav_msgs::Odometry &msg, const double *pose_covariance, const double *twist_covariance)
+{
+  //nav_msgs::Odometry has 6x6 covariance matrices (x, y, z, roll, pitch, yaw)
+  static const int pose_index[3] = { 0, 1, 5 };
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      msg.pose.covariance[pose_index[i] * 6 + pose_index[j]] = pose_covariance[i * 3 + j];
+
+  static const int twist_index[2] = { 0, 5 };
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      msg.twist.covariance[twist_index[i] * 6 + twist_index[j]] = twist_covariance[i * 2 + j];
+
+  // not measured
+  msg.pose.covariance[14] = DBL_MAX;
+  msg.pose.covariance[21] = DBL_MAX;
+  msg.pose.covariance[28] = DBL_MAX;
+
+  msg.twist.covariance[7] = DBL_MAX;
+  msg.twist.covariance[14] = DBL_MAX;
+  msg.twist.covariance[21] = DBL_MAX;
+  msg.twist.covariance[28] = DBL_MAX;
+}
+
+void ROSComm::send_odometry(double z, double x, double theta, double v_encoder, double v_encoder_angular, int wheel_a, int wheel_b, double v_encoder_left, double v_encoder_right,
+    const double *pose_covariance, const double *twist_covariance)
+{
+  nav_msgs::Odometry::Ptr odom(new nav_msgs::Odometry);
+  odom->header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
+  odom->child_frame_id = tf::resolve(tf_prefix_, "base_footprint");
+
+  odom->header.stamp = ros::Time::now();
+  odom->pose.pose.position.x = z;
+  odom->pose.pose.position.y = -x;
+  odom->pose.pose.position.z = 0.0;
+  odom->pose.pose.orientation = tf::createQuaternionMsgFromYaw(-theta);
+
+  odom->twist.twist.linear.x = v_encoder;
+  odom->twist.twist.linear.y = 0.0;
+  odom->twist.twist.angular.z = v_encoder_angular;
+  populateCovariance(*odom, pose_covariance, twist_covariance);
+
+  odom_pub_.publish(odom);
+
+  if (publish_tf_ && !fused_tf_)
+  {
+    geometry_msgs::TransformStamped odom_trans;
+    odom_trans.header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
+    odom_trans.child_frame_id = tf::resolve(tf_prefix_, "base_footprint");
+
+    odom_trans.header.stamp = ros::Time::now();
+    odom_trans.transform.translation.x = z;
+    odom_trans.transform.translation.y = -x;
+    odom_trans.transform.translation.z = 0.0;
+    odom_trans.transform.rotation = tf::createQuaternionMsgFromYaw(-theta);
+
+    odom_broadcaster_.sendTransform(odom_trans);
+  }
+
+  sensor_msgs::JointState::Ptr joint_state(new sensor_msgs::JointState);
+  joint_state->header.stamp = ros::Time::now();
+  joint_state->name.resize(6);
+  joint_state->position.resize(6);
+  joint_state->name[0] = "left_front_wheel_joint";
+  joint_state->name[1] = "left_middle_wheel_joint";
+  joint_state->name[2] = "left_rear_wheel_joint";
+  joint_state->name[3] = "right_front_wheel_joint";
+  joint_state->name[4] = "right_middle_wheel_joint";
+  joint_state->name[5] = "right_rear_wheel_joint";
+
+  wheelpos_l_ += 2.0 * M_PI * wheel_a / ticks_per_turn_of_wheel_;
+  if (wheelpos_l_ > M_PI)
+    wheelpos_l_ -= 2.0 * M_PI;
+  if (wheelpos_l_ < -M_PI)
+    wheelpos_l_ += 2.0 * M_PI;
+
+  wheelpos_r_ += 2 * M_PI * wheel_b / ticks_per_turn_of_wheel_;
+  if (wheelpos_r_ > M_PI)
+    wheelpos_r_ -= 2.0 * M_PI;
+  if (wheelpos_r_ < -M_PI)
+    wheelpos_r_ += 2.0 * M_PI;
+
+  joint_state->position[0] = joint_state->position[1] = joint_state->position[2] = wheelpos_l_;
+  joint_state->position[3] = joint_state->position[4] = joint_state->position[5] = wheelpos_r_;
+
+  joint_pub_.publish(joint_state);
+}
+
+void ROSComm::send_range(const char *frame, bool ultrasound, int range)
+{
+  sensor_msgs::Range::Ptr msg(new sensor_msgs::Range);
+  msg->header.stamp = ros::Time::now();
+  msg->header.frame_id = tf::resolve(tf_prefix_, frame);
+  if (ultrasound)
+  {
+    msg->radiation_type = sensor_msgs::Range::ULTRASOUND;
+    msg->field_of_view = SONAR_FOV;
+    msg->min_range = SONAR_MIN;
+    msg->max_range = SONAR_MAX;
+  }
+  else
+  {
+    msg->radiation_type = sensor_msgs::Range::INFRARED;
+    msg->field_of_view = IR_FOV;
+    msg->min_range = IR_MIN;
+    msg->max_range = IR_MAX;
+  }
+  msg->range = range / 100.0;
+  range_pub_.publish(msg);
+}
+
+void ROSComm::send_sonar_leftBack(int ir_left_back)
+{
+  send_range("ir_left_back", false, ir_left_back);
+}
+
+void ROSComm::send_sonar_front_usound_leftFront_left(int ir_right_front, int usound, int ir_left_front, int ir_left)
+{
+  send_range("ir_right_front", false, ir_right_front);
+  send_range("ultrasound_front", true, usound);
+  send_range("ir_left_front", false, ir_left_front);
+  send_range("ir_left", false, ir_left);
+}
+
+void ROSComm::send_sonar_back_rightBack_rightFront(int ir_back, int ir_right_back, int ir_right)
+{
+  send_range("ir_back", false, ir_back);
+  send_range("ir_right_back", false, ir_right_back);
+  send_range("ir_right", false, ir_right);
+}
+
+void ROSComm::send_imu(double roll, double pitch, double yaw, double yaw_rate,
+    double tilt_variance, double yaw_variance, double stamp)
+{
+  sensor_msgs::Imu::Ptr imu(new sensor_msgs::Imu);
+
+  // this is intentionally base_link (the location of the imu) and not base_footprint,
+  // but because they are connected by a fixed link, it doesn't matter
+  imu->header.frame_id = tf::resolve(tf_prefix_, "base_link");
+  // time of the CAN frame
+  imu->header.stamp = stamp > 0.0 ? ros::Time(stamp) : ros::Time::now();
+
+  // only the yaw rate is measured, covariance unknown
+  imu->angular_velocity.z = yaw_rate;
+  imu->linear_acceleration_covariance[0] = -1; // no data avilable, see Imu.msg
+
+  imu->orientation = tf::createQuaternionMsgFromRollPitchYaw(roll, pitch, yaw);
+  imu->orientation_covariance[0] = tilt_variance;
+  imu->orientation_covariance[4] = tilt_variance;
+  imu->orientation_covariance[8] = yaw_variance;
+  imu_pub_.publish(imu);
+}
+
+void ROSComm::send_odom_combined(double x, double y, double yaw, const double *covariance, double stamp)
+{
+  // pose and transform share the stamp of the encoder frame
+  ros::Time time = stamp > 0.0 ? ros::Time(stamp) : ros::Time::now();
+
+  geometry_msgs::PoseWithCovarianceStamped::Ptr pose(new geometry_msgs::PoseWithCovarianceStamped);
+  pose->header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
+  pose->header.stamp = time;
+  pose->pose.pose.position.x = x;
+  pose->pose.pose.position.y = y;
+  pose->pose.pose.orientation = tf::createQuaternionMsgFromYaw(yaw);
+
+  // x, y, yaw into the 6x6 x, y, z, roll, pitch, yaw matrix
+  static const int index[3] = { 0, 1, 5 };
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      pose->pose.covariance[index[i] * 6 + index[j]] = covariance[i * 3 + j];
+  // planar robot
+  pose->pose.covariance[14] = 1e-9;
+  pose->pose.covariance[21] = 1e-9;
+  pose->pose.covariance[28] = 1e-9;
+  odom_combined_pub_.publish(pose);
+
+  if (publish_tf_)
+  {
+    geometry_msgs::TransformStamped odom_trans;
+    odom_trans.header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
+    odom_trans.child_frame_id = tf::resolve(tf_prefix_, "base_footprint");
+    odom_trans.header.stamp = time;
+    odom_trans.transform.translation.x = x;
+    odom_trans.transform.translation.y = y;
+    odom_trans.transform.translation.z = 0.0;
+    odom_trans.transform.rotation = tf::createQuaternionMsgFromYaw(yaw);
+
+    odom_broadcaster_.sendTransform(odom_trans);
+  }
+}
+
+// slip is the one of the track that is further off
+void ROSComm::send_slip(double turning_adaptation, double slip_left, double slip_right)
+{
+  std_msgs::Float64 adaptation_msg;
+  adaptation_msg.data = turning_adaptation;
+  turning_adaptation_pub_.publish(adaptation_msg);
+
+  std_msgs::Float64 slip_msg;
+  slip_msg.data = fabs(slip_left) > fabs(slip_right) ? slip_left : slip_right;
+  slip_pub_.publish(slip_msg);
+}
+
+static void add_value(diagnostic_msgs::DiagnosticStatus &status, const char *key, const char *format, double value)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), format, value);
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  kv.value = buf;
+  status.values.push_back(kv);
+}
+
+void ROSComm::send_mcu_health(const McuHealth &health)
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "kurt_base: micro controller";
+  char hw_id[16];
+  snprintf(hw_id, sizeof(hw_id), "0x%04x", health.hw_id);
+  status.hardware_id = hw_id;
+  status.level = health.level; // MCU_* are the DiagnosticStatus levels
+  status.message = health.message;
+
+  add_value(status, "firmware version", "%.0f", health.firmware_version);
+  add_value(status, "cycle time [ms]", "%.2f", health.cycle_time * 1000.0);
+  add_value(status, "left current [A]", "%.2f", health.current_left);
+  add_value(status, "right current [A]", "%.2f", health.current_right);
+  add_value(status, "left peak current [A]", "%.2f", health.peak_current_left);
+  add_value(status, "right peak current [A]", "%.2f", health.peak_current_right);
+  add_value(status, "left power [W]", "%.1f", health.power_left);
+  add_value(status, "right power [W]", "%.1f", health.power_right);
+  add_value(status, "temperature [C]", "%.1f", health.temperature);
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  diagnostics_pub_.publish(msg);
+}
+
+void ROSComm::send_odometry_check(double position_error, double yaw_error, bool consistent)
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "kurt_base: odometry";
+  status.level = consistent ? diagnostic_msgs::DiagnosticStatus::OK : diagnostic_msgs::DiagnosticStatus::WARN;
+  status.message = consistent ? "host and micro controller agree" : "host and micro controller differ";
+  add_value(status, "position error [m]", "%.3f", position_error);
+  add_value(status, "yaw error [rad]", "%.3f", yaw_error);
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  diagnostics_pub_.publish(msg);
+}
+
+void ROSComm::send_local_grid(const LocalGrid &grid, double stamp)
+{
+  nav_msgs::OccupancyGrid::Ptr msg(new nav_msgs::OccupancyGrid);
+  msg->header.frame_id = tf::resolve(tf_prefix_, "odom_combined");
+  msg->header.stamp = stamp > 0.0 ? ros::Time(stamp) : ros::Time::now();
+  msg->info.map_load_time = msg->header.stamp;
+  msg->info.resolution = grid.resolution();
+  msg->info.width = LOCAL_GRID_SIZE;
+  msg->info.height = LOCAL_GRID_SIZE;
+  msg->info.origin.position.x = grid.originX();
+  msg->info.origin.position.y = grid.originY();
+
+  // log-odds to occupancy probability in percent, -1 unknown
+  msg->data.resize(LOCAL_GRID_SIZE * LOCAL_GRID_SIZE);
+  int8_t row[LOCAL_GRID_SIZE];
+  for (int j = 0; j < LOCAL_GRID_SIZE; j++)
+  {
+    grid.row(j, row);
+    for (int i = 0; i < LOCAL_GRID_SIZE; i++)
+      msg->data[j * LOCAL_GRID_SIZE + i] = row[i] == 0 ? -1 : (int8_t)(100.0 / (1.0 + exp(-row[i] / 20.0)));
+  }
+  local_grid_pub_.publish(msg);
+}
+
+void ROSComm::send_rotunit(double rot)
+{
+  sensor_msgs::JointState::Ptr joint_state(new sensor_msgs::JointState);
+  joint_state->header.stamp = ros::Time::now();
+  joint_state->name.resize(1);
+  joint_state->position.resize(1);
+  joint_state->name[0] = "laser_rot_joint";
+  joint_state->position[0] = rot;
+
+  joint_pub_.publish(joint_state);
+}
+
+void ROSComm::send_bumper(int bumper, int remote_control, bool stopped)
+{
+  std_msgs::UInt8 bumper_msg;
+  bumper_msg.data = bumper;
+  bumper_pub_.publish(bumper_msg);
+
+  std_msgs::UInt8 remote_control_msg;
+  remote_control_msg.data = remote_control;
+  remote_control_pub_.publish(remote_control_msg);
+
+  std_msgs::Bool stop_msg;
+  stop_msg.data = stopped;
+  bumper_stop_pub_.publish(stop_msg);
+}
+
+// latched, the reason of the last trip or "ok"
+void ROSComm::send_watchdog(bool tripped, const char *reason)
+{
+  std_msgs::String msg;
+  msg.data = reason;
+  watchdog_pub_.publish(msg);
+}
+
+// latched
+void ROSComm::send_can_available(bool available)
+{
+  std_msgs::Bool msg;
+  msg.data = available;
+  can_available_pub_.publish(msg);
+}
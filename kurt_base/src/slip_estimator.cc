@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+
+#include "slip_estimator.h"
+
+// initial covariance, also the bound against windup
+#define SLIP_P0 100.0
+// range of a_l, a_r
+#define SLIP_A_MIN 0.1
+#define SLIP_A_MAX 1.5
+
+SlipEstimator::SlipEstimator(double turning_adaptation, double forgetting, int window, double min_turn) :
+  nominal_(turning_adaptation),
+  forgetting_(forgetting),
+  window_(window > 0 ? window : 1),
+  min_turn_(min_turn),
+  yaw_valid_(false),
+  window_yaw_(0.0),
+  frames_(0),
+  turn_l_(0.0),
+  turn_r_(0.0)
+{
+  a_[0] = a_[1] = turning_adaptation;
+  P_[0][0] = P_[1][1] = SLIP_P0;
+  P_[0][1] = P_[1][0] = 0.0;
+}
+
+void SlipEstimator::setParameters(double forgetting, int window, double min_turn)
+{
+  forgetting_ = forgetting;
+  window_ = window > 0 ? window : 1;
+  min_turn_ = min_turn;
+}
+
+void SlipEstimator::addWheels(double turn_l, double turn_r)
+{
+  turn_l_ += turn_l;
+  turn_r_ += turn_r;
+}
+
+bool SlipEstimator::addYaw(double yaw)
+{
+  if (!yaw_valid_)
+  {
+    window_yaw_ = yaw;
+    yaw_valid_ = true;
+    frames_ = 0;
+    turn_l_ = turn_r_ = 0.0;
+    return false;
+  }
+  if (++frames_ < window_)
+    return false;
+
+  double dyaw = remainder(yaw - window_yaw_, 2.0 * M_PI);
+  double phi[2] = { -turn_l_, turn_r_ };
+  window_yaw_ = yaw;
+  frames_ = 0;
+  turn_l_ = turn_r_ = 0.0;
+
+  // standing or (almost) no motion of the tracks
+  if (fabs(phi[0]) + fabs(phi[1]) < min_turn_)
+    return false;
+
+  // K = P phi / (lambda + phi^T P phi)
+  double Pphi[2] = {
+    P_[0][0] * phi[0] + P_[0][1] * phi[1],
+    P_[1][0] * phi[0] + P_[1][1] * phi[1] };
+  double S = forgetting_ + phi[0] * Pphi[0] + phi[1] * Pphi[1];
+  double K[2] = { Pphi[0] / S, Pphi[1] / S };
+
+  double error = dyaw - (phi[0] * a_[0] + phi[1] * a_[1]);
+  for (int i = 0; i < 2; i++)
+    a_[i] = std::min(SLIP_A_MAX, std::max(SLIP_A_MIN, a_[i] + K[i] * error));
+
+  // P = (P - K phi^T P) / lambda, bounded
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      P_[i][j] = (P_[i][j] - K[i] * Pphi[j]) / forgetting_;
+  for (int i = 0; i < 2; i++)
+  {
+    if (P_[i][i] > SLIP_P0)
+    {
+      double scale = sqrt(SLIP_P0 / P_[i][i]);
+      for (int j = 0; j < 2; j++)
+      {
+        P_[i][j] *= scale;
+        P_[j][i] *= scale;
+      }
+    }
+  }
+  return true;
+}
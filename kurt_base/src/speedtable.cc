@@ -1,14 +1,166 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "kurt.h"
 #include "stdoutcomm.h"
 #include "mytime.h"
 
+// adaptive calibration: encoder frames arrive every 10 ms
+#define WINDOW           25     // frames per steady state window
+#define MAX_WINDOWS      12     // give up waiting for steady state after 3 s
+#define STEADY_STDDEV    0.005  // [m/s]
+#define STEADY_DRIFT     0.003  // [m/s] between two windows
+#define LINEAR_TOLERANCE 0.01   // [m/s] allowed deviation from the linear prediction
+#define MIN_STEP         1
+#define MAX_STEP         64
+
+struct Sample
+{
+  int pwm;
+  double v, vl, vr;
+};
+
 void usage(char *pgrname)
 {
-  printf("%s: <configfile> <start-pwm-value>\n",pgrname);
+  printf("%s: <configfile> <start-pwm-value> [adaptive [updown]]\n",pgrname);
+  printf("  adaptive: steady state detection and adaptive pwm steps\n");
+  printf("  updown:   additionally sweep down, writes <configfile>.up and .down\n");
+}
+
+// drives with pwm until the encoder speeds settle, returns their mean
+bool measure_steady(Kurt &kurt, STDoutComm &stdoutcomm, int pwm, Sample *sample)
+{
+  double prev_vl = 0.0, prev_vr = 0.0;
+  bool steady = false;
+
+  for (int w = 0; w < MAX_WINDOWS && !steady; w++) {
+    double sum_l = 0.0, sum_r = 0.0, sum_ll = 0.0, sum_rr = 0.0, sum_v = 0.0;
+    for (int f = 0; f < WINDOW; f++) {
+      if (f % 10 == 0) // alle 100 ms senden sonst ausfall
+        kurt.can_motor(1024 - pwm, 0, 0, 1024 - pwm, 0, 0);
+      int id;
+      while ((id = kurt.can_read_fifo()) != CAN_ENCODER)
+        if (id < 0)
+          return false;
+      double vl = stdoutcomm.v1_left(), vr = stdoutcomm.v1_right();
+      sum_l += vl; sum_ll += vl * vl;
+      sum_r += vr; sum_rr += vr * vr;
+      sum_v += stdoutcomm.v1();
+    }
+    double vl = sum_l / WINDOW, vr = sum_r / WINDOW;
+    double sd_l = sqrt(std::max(0.0, sum_ll / WINDOW - vl * vl));
+    double sd_r = sqrt(std::max(0.0, sum_rr / WINDOW - vr * vr));
+
+    steady = w > 0 && sd_l < STEADY_STDDEV && sd_r < STEADY_STDDEV
+      && fabs(vl - prev_vl) < STEADY_DRIFT && fabs(vr - prev_vr) < STEADY_DRIFT;
+    prev_vl = vl;
+    prev_vr = vr;
+
+    sample->pwm = pwm;
+    sample->v = sum_v / WINDOW;
+    sample->vl = vl;
+    sample->vr = vr;
+  }
+  if (!steady)
+    printf("pwm %d: no steady state, using last window\n", pwm);
+  return true;
+}
+
+// sweeps from pwm from to pwm to, dense where the curve bends
+bool adaptive_sweep(Kurt &kurt, STDoutComm &stdoutcomm, int from, int to, std::vector<Sample> &samples)
+{
+  int dir = to > from ? 1 : -1;
+  int step = 8;
+  int pwm = from;
+
+  while (true) {
+    Sample sample;
+    if (!measure_steady(kurt, stdoutcomm, pwm, &sample))
+      return false;
+
+    // compare with the linear prediction from the last two samples
+    size_t n = samples.size();
+    if (n >= 2) {
+      const Sample &a = samples[n - 2], &b = samples[n - 1];
+      double t = (double)(pwm - b.pwm) / (b.pwm - a.pwm);
+      double err = std::max(fabs(sample.vl - (b.vl + t * (b.vl - a.vl))),
+                            fabs(sample.vr - (b.vr + t * (b.vr - a.vr))));
+      if (err > LINEAR_TOLERANCE && abs(pwm - b.pwm) > MIN_STEP && abs(to - b.pwm) > MIN_STEP) {
+        // curve bends: retry closer to the last sample, never beyond to
+        step = std::max(MIN_STEP, step / 2);
+        pwm = b.pwm + dir * step;
+        if ((to - pwm) * dir < 0)
+          pwm = to;
+        continue;
+      }
+      if (err < LINEAR_TOLERANCE / 4)
+        step = std::min(MAX_STEP, step * 2);
+    }
+
+    printf("t1: %Lf, v: %lf, vl: %lf, vr: %lf, pwm: %d, step: %d\n",
+        Get_mtime_diff(9), sample.v, sample.vl, sample.vr, pwm, step);
+    samples.push_back(sample);
+
+    if (pwm == to)
+      return true;
+    pwm += dir * step;
+    if ((to - pwm) * dir < 0)
+      pwm = to;
+  }
+}
+
+// interpolates the samples to one entry per pwm 0 - 1024
+void interpolate(const std::vector<Sample> &samples, int startpwm, std::vector<Sample> &table)
+{
+  std::vector<Sample> sorted;
+  for (size_t k = 0; k < samples.size(); k++) {
+    size_t pos = 0;
+    while (pos < sorted.size() && sorted[pos].pwm < samples[k].pwm)
+      pos++;
+    sorted.insert(sorted.begin() + pos, samples[k]);
+  }
+
+  table.resize(1025);
+  size_t k = 0;
+  for (int pwm = 0; pwm <= 1024; pwm++) {
+    Sample &entry = table[pwm];
+    entry.pwm = pwm;
+    entry.v = entry.vl = entry.vr = 0.0;
+    if (pwm >= startpwm && !sorted.empty()) {
+      while (k + 1 < sorted.size() && sorted[k + 1].pwm <= pwm)
+        k++;
+      const Sample &a = sorted[k], &b = sorted[std::min(k + 1, sorted.size() - 1)];
+      double t = b.pwm > a.pwm ? std::max(0.0, std::min(1.0, (double)(pwm - a.pwm) / (b.pwm - a.pwm))) : 0.0;
+      entry.v = a.v + t * (b.v - a.v);
+      entry.vl = a.vl + t * (b.vl - a.vl);
+      entry.vr = a.vr + t * (b.vr - a.vr);
+    }
+  }
+}
+
+// writes one line per pwm in the speedtable format
+void write_table(const std::string &filename, const std::vector<Sample> &table)
+{
+  FILE *fpr = fopen(filename.c_str(), "w");
+  if (fpr == NULL) {
+    printf("Error opening %s\n", filename.c_str());
+    return;
+  }
+
+  // speed must be increasing
+  double max_v = 0.0, max_vl = 0.0, max_vr = 0.0;
+  for (size_t k = 0; k < table.size(); k++) {
+    max_v = std::max(max_v, table[k].v);
+    max_vl = std::max(max_vl, table[k].vl);
+    max_vr = std::max(max_vr, table[k].vr);
+    fprintf(fpr, "%Lf %lf %lf %lf %d\n", Get_mtime_diff(9), max_v, max_vl, max_vr, table[k].pwm);
+  }
+  fclose(fpr);
 }
 
 int main(int argc, char **argv)
@@ -23,14 +175,63 @@ int main(int argc, char **argv)
   int finish = 0;
   int startpwm = 1;
 
-  if (argc == 3) {
+  bool adaptive = false, updown = false;
+
+  if (argc >= 3 && argc <= 5) {
     startpwm = atoi(argv[2]);
+    adaptive = argc >= 4 && strcmp(argv[3], "adaptive") == 0;
+    updown = argc == 5 && strcmp(argv[4], "updown") == 0;
+    if ((argc >= 4 && !adaptive) || (argc == 5 && !updown)) {
+      usage(argv[0]);
+      return 0;
+    }
   }
   else {
     usage(argv[0]);
     return 0;
   }
 
+  if (adaptive) {
+    //Odometry parameter (defaults for kurt2 indoor)
+    STDoutComm stdoutcomm;
+    CAN can;
+    Kurt kurt(stdoutcomm, can, 0.379, 0.28, 0.69, 21950);
+
+    std::vector<Sample> up, down;
+    Get_mtime_diff(9);
+    bool ok = adaptive_sweep(kurt, stdoutcomm, startpwm, 1024, up);
+    if (ok && updown)
+      ok = adaptive_sweep(kurt, stdoutcomm, 1024, startpwm, down);
+
+    // langsames stoppen ueber 1024 * 20 ms
+    i = updown ? startpwm : 1024;
+    for (k = 0; k <= i; k++) {
+      kurt.can_motor(1024 - i + k, 0, 0, 1024 - i + k, 0, 0);
+      mydelay(20);
+    }
+    if (!ok) {
+      printf("Error reading encoders\n");
+      return 1;
+    }
+
+    std::vector<Sample> table_up, table_down;
+    interpolate(up, startpwm, table_up);
+    if (updown) {
+      interpolate(down, startpwm, table_down);
+      write_table(std::string(argv[1]) + ".up", table_up);
+      write_table(std::string(argv[1]) + ".down", table_down);
+      // the table is the mean of both sweeps
+      for (size_t n = 0; n < table_up.size(); n++) {
+        table_up[n].v = 0.5 * (table_up[n].v + table_down[n].v);
+        table_up[n].vl = 0.5 * (table_up[n].vl + table_down[n].vl);
+        table_up[n].vr = 0.5 * (table_up[n].vr + table_down[n].vr);
+      }
+    }
+    write_table(argv[1], table_up);
+    printf("Bye Bye Spoki\n");
+    return 0;
+  }
+
   fpr = fopen(argv[1], "w");
 
   // fill with zeros until startpwm
@@ -46,7 +247,8 @@ int main(int argc, char **argv)
   int ticks_per_turn_of_wheel = 21950;
 
   STDoutComm stdoutcomm;
-  Kurt kurt(stdoutcomm, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
+  CAN can;
+  Kurt kurt(stdoutcomm, can, wheel_perimeter, axis_length, turning_adaptation, ticks_per_turn_of_wheel);
 
   i = j = startpwm;
   Get_mtime_diff(3);
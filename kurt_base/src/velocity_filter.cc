@@ -0,0 +1,90 @@
+#include <algorithm>
+
+#include "velocity_filter.h"
+
+VelocityFilter *VelocityFilter::create(const std::string &type, int window, double alpha,
+    double process_noise, double measurement_noise, double dt)
+{
+  if (type == "moving_average")
+    return new MovingAverageFilter(window);
+  if (type == "median")
+    return new MedianFilter(window);
+  if (type == "ema")
+    return new EMAFilter(alpha);
+  if (type == "kalman")
+    return new KalmanFilter(process_noise, measurement_noise, dt);
+  return NULL;
+}
+
+double MovingAverageFilter::filter(double v)
+{
+  sum_ += v - buffer_.push(v);
+  return sum_ / buffer_.size();
+}
+
+void MovingAverageFilter::reset()
+{
+  buffer_.clear();
+  sum_ = 0.0;
+}
+
+double MedianFilter::filter(double v)
+{
+  // replace the oldest value, keeping sorted_ in order
+  double old = buffer_.push(v);
+  std::vector<double>::iterator it = std::lower_bound(sorted_.begin(), sorted_.end(), old);
+  sorted_.erase(it);
+  sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), v), v);
+
+  size_t n = sorted_.size();
+  if (n % 2)
+    return sorted_[n / 2];
+  return 0.5 * (sorted_[n / 2 - 1] + sorted_[n / 2]);
+}
+
+void MedianFilter::reset()
+{
+  buffer_.clear();
+  sorted_.assign(sorted_.size(), 0.0);
+}
+
+double EMAFilter::filter(double v)
+{
+  v_ += alpha_ * (v - v_);
+  return v_;
+}
+
+void EMAFilter::reset()
+{
+  v_ = 0.0;
+}
+
+double KalmanFilter::filter(double v)
+{
+  // predict: v += a * dt, process noise of a white jerk
+  v_ += a_ * dt_;
+  p_vv_ += dt_ * (2.0 * p_va_ + dt_ * p_aa_) + q_ * dt_ * dt_ * dt_ / 3.0;
+  p_va_ += dt_ * p_aa_ + q_ * dt_ * dt_ / 2.0;
+  p_aa_ += q_ * dt_;
+
+  // update with the measured velocity
+  double s = p_vv_ + r_;
+  double k_v = p_vv_ / s;
+  double k_a = p_va_ / s;
+  double innovation = v - v_;
+  v_ += k_v * innovation;
+  a_ += k_a * innovation;
+  p_aa_ -= k_a * p_va_;
+  p_va_ -= k_a * p_vv_;
+  p_vv_ -= k_v * p_vv_;
+
+  return v_;
+}
+
+void KalmanFilter::reset()
+{
+  v_ = a_ = 0.0;
+  p_vv_ = r_;
+  p_va_ = 0.0;
+  p_aa_ = q_;
+}
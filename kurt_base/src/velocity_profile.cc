@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cmath>
+
+#include "velocity_profile.h"
+
+void VelocityProfile::reset(double v)
+{
+  v_ = v;
+  a_ = 0.0;
+}
+
+double VelocityProfile::stopTime(double v) const
+{
+  v = fabs(v);
+  // the acceleration limit is reached after max_acc / max_jerk
+  if (v >= max_acc_ * max_acc_ / max_jerk_)
+    return v / max_acc_ + max_acc_ / max_jerk_;
+  return 2.0 * sqrt(v / max_jerk_);
+}
+
+double VelocityProfile::update(double target, double dt)
+{
+  double da_max = max_jerk_ * dt;
+  double error = target - v_;
+
+  // the target is reached within this step and the acceleration can go to
+  // zero in the next one
+  double a_end = error / dt;
+  if (fabs(a_end - a_) <= da_max && fabs(a_end) <= da_max)
+  {
+    a_ = a_end;
+    v_ = target;
+    return v_;
+  }
+
+  // the acceleration from which a ramp down at max_jerk just ends at the
+  // target, the ramp down of the current step is subtracted
+  double remaining = std::max(0.0, fabs(error) - 0.5 * fabs(a_) * dt);
+  double a_target = sqrt(2.0 * max_jerk_ * remaining);
+  if (error < 0.0)
+    a_target = -a_target;
+  a_target = std::max(-max_acc_, std::min(max_acc_, a_target));
+
+  a_ += std::max(-da_max, std::min(da_max, a_target - a_));
+  v_ += a_ * dt;
+  return v_;
+}
@@ -0,0 +1,110 @@
+#include <ctime>
+
+#include <boost/bind.hpp>
+
+#include "kurt_clock.h"
+#include "watchdog.h"
+
+Watchdog::Watchdog(double command_timeout, double rx_timeout, double control_deadline, double period,
+    const boost::function<void (Reason)> &trip, const boost::function<void ()> &release) :
+  command_timeout_(command_timeout),
+  rx_timeout_(rx_timeout),
+  control_deadline_(control_deadline),
+  period_(period),
+  trip_(trip),
+  release_(release),
+  last_cycle_(-1.0),
+  moving_(false),
+  stop_(false)
+{
+  last_command_ = last_frame_ = monotonic_seconds();
+  thread_ = boost::thread(boost::bind(&Watchdog::run, this));
+}
+
+Watchdog::~Watchdog()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  thread_.join();
+}
+
+void Watchdog::commandReceived(bool moving)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  last_command_ = monotonic_seconds();
+  moving_ = moving;
+}
+
+void Watchdog::frameReceived()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  last_frame_ = monotonic_seconds();
+}
+
+void Watchdog::controlCycle()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  last_cycle_ = monotonic_seconds();
+}
+
+const char *Watchdog::reasonString(Reason reason)
+{
+  switch (reason)
+  {
+    case COMMAND_TIMEOUT:
+      return "command timeout";
+    case CAN_RX_TIMEOUT:
+      return "no CAN frames from Kurt";
+    case CONTROL_DEADLINE:
+      return "control loop missed its deadline";
+    default:
+      return "ok";
+  }
+}
+
+Watchdog::Reason Watchdog::check(double now)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (rx_timeout_ > 0.0 && now - last_frame_ > rx_timeout_)
+    return CAN_RX_TIMEOUT;
+  if (control_deadline_ > 0.0 && last_cycle_ >= 0.0 && now - last_cycle_ > control_deadline_)
+    return CONTROL_DEADLINE;
+  if (command_timeout_ > 0.0 && moving_ && now - last_command_ > command_timeout_)
+    return COMMAND_TIMEOUT;
+  return NONE;
+}
+
+void Watchdog::run()
+{
+  Reason tripped = NONE;
+  timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  long period_ns = (long)(period_ * 1e9);
+
+  while (true)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (stop_)
+        return;
+    }
+
+    Reason reason = check(monotonic_seconds());
+    if (reason != NONE && tripped == NONE)
+      trip_(reason);
+    else if (reason == NONE && tripped != NONE)
+      release_();
+    tripped = reason;
+
+    // absolute schedule, a late wakeup does not shift the following ones
+    next.tv_nsec += period_ns;
+    while (next.tv_nsec >= 1000000000L)
+    {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+}
@@ -0,0 +1,68 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include "velocity_profile.h"
+
+#define MAX_ACC  0.5
+#define MAX_JERK 2.0
+#define EPSILON  1e-9
+
+// runs the profile towards target and checks the limits on every step
+static void track(VelocityProfile &profile, double target, double dt, int steps)
+{
+  double start = profile.velocity();
+  for (int i = 0; i < steps; i++)
+  {
+    double a = profile.acceleration();
+    profile.update(target, dt);
+    ASSERT_LE(fabs(profile.acceleration() - a), MAX_JERK * dt + EPSILON) << "step " << i;
+    ASSERT_LE(fabs(profile.acceleration()), MAX_ACC + EPSILON) << "step " << i;
+    // no overshoot of the target
+    if (target > start)
+      ASSERT_LE(profile.velocity(), target + EPSILON) << "step " << i;
+    else
+      ASSERT_GE(profile.velocity(), target - EPSILON) << "step " << i;
+  }
+}
+
+TEST(VelocityProfile, StepResponse)
+{
+  const double dts[] = { 0.005, 0.01, 0.02 };
+  for (int k = 0; k < 3; k++)
+  {
+    VelocityProfile profile(MAX_ACC, MAX_JERK);
+    track(profile, 1.0, dts[k], 1000);
+    EXPECT_EQ(1.0, profile.velocity());
+    EXPECT_EQ(0.0, profile.acceleration());
+  }
+}
+
+TEST(VelocityProfile, SmallStepsAndStop)
+{
+  VelocityProfile profile(MAX_ACC, MAX_JERK);
+  const double targets[] = { 0.3, -0.7, 0.001, 0.0 };
+  for (int k = 0; k < 4; k++)
+  {
+    track(profile, targets[k], 0.01, 1000);
+    EXPECT_EQ(targets[k], profile.velocity());
+  }
+  EXPECT_TRUE(profile.atRest());
+}
+
+TEST(VelocityProfile, TargetChangesWhileRamping)
+{
+  VelocityProfile profile(MAX_ACC, MAX_JERK);
+  for (int i = 0; i < 3000; i++)
+  {
+    double a = profile.acceleration();
+    profile.update(i % 137 < 70 ? 1.0 : -1.0, 0.01);
+    ASSERT_LE(fabs(profile.acceleration() - a), MAX_JERK * 0.01 + EPSILON) << "step " << i;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+#ifndef _REVOLUTION_LOG_H_
+#define _REVOLUTION_LOG_H_
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include <sensor_msgs/PointCloud2.h>
+
+/*
+ * On-disk log of rotunit revolutions, written as two files:
+ *
+ * <name>.rev: magic, then one LZ4 compressed block per revolution holding
+ *             nr_points * 3 int16 coordinates (x, y, z interleaved),
+ *             quantised with resolution relative to the pose position
+ * <name>.idx: magic, then one RevolutionIndexEntry per revolution
+ */
+
+#define REVOLUTION_LOG_MAGIC "KURTREV1"
+#define REVOLUTION_LOG_MAGIC_SIZE 8
+
+struct RevolutionIndexEntry
+{
+  uint32_t seq;
+  uint32_t stamp_sec;
+  uint32_t stamp_nsec;
+  uint32_t nr_points;
+  // pose of the robot in the cloud frame: x, y, z, qx, qy, qz, qw
+  double pose[7];
+  double resolution; // [m]
+  uint64_t offset;   // of the compressed block in the .rev file
+  uint32_t compressed_size;
+  uint32_t raw_size;
+} __attribute__((packed));
+
+/**
+ * Quantises, compresses and appends revolutions on a background thread.
+ * At most queue_size revolutions are buffered; further ones are dropped
+ * until the writer catches up.
+ */
+class RevolutionWriter
+{
+  public:
+    RevolutionWriter(const std::string &filename, double resolution, size_t queue_size);
+    ~RevolutionWriter();
+
+    bool isOpen() const { return data_file_ != NULL && index_file_ != NULL; }
+
+    /**
+     * @return false if the queue is full and the revolution was dropped
+     */
+    bool write(const sensor_msgs::PointCloud2::ConstPtr &cloud, const double pose[7]);
+
+  private:
+    struct Job
+    {
+      sensor_msgs::PointCloud2::ConstPtr cloud;
+      double pose[7];
+    };
+
+    void run();
+    void writeJob(const Job &job);
+
+    FILE *data_file_;
+    FILE *index_file_;
+    uint64_t offset_;
+    uint32_t seq_;
+    double resolution_;
+    size_t queue_size_;
+
+    std::deque<Job> queue_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    bool stop_;
+    boost::thread thread_;
+};
+
+/**
+ * Random access to the revolutions of a log through memory mapped files.
+ */
+class RevolutionReader
+{
+  public:
+    RevolutionReader();
+    ~RevolutionReader();
+
+    bool open(const std::string &filename);
+    void close();
+
+    size_t size() const { return nr_entries_; }
+    const RevolutionIndexEntry &entry(size_t i) const { return entries_[i]; }
+
+    /**
+     * Decompresses revolution i into points (x, y, z interleaved, in meters,
+     * in the cloud frame).
+     */
+    bool read(size_t i, std::vector<float> &points) const;
+
+  private:
+    void *data_;
+    size_t data_size_;
+    void *index_;
+    size_t index_size_;
+    const RevolutionIndexEntry *entries_;
+    size_t nr_entries_;
+};
+
+#endif
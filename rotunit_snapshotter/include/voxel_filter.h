@@ -0,0 +1,64 @@
+#ifndef _VOXEL_FILTER_H_
+#define _VOXEL_FILTER_H_
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <sensor_msgs/PointCloud2.h>
+
+/**
+ * Multi-threaded downsampling of assembled clouds.
+ *
+ * VOXEL_GRID replaces all points falling into one cubic leaf by their
+ * centroid (the remaining fields are taken from the first point of the
+ * leaf). The points are keyed by their packed voxel coordinates, hashed into
+ * one partition per thread and every partition is sorted and reduced on its
+ * own, so the threads never share a voxel.
+ *
+ * RANDOM_SUBSAMPLE keeps every point with probability keep_ratio.
+ */
+class VoxelFilter
+{
+  public:
+    enum Mode
+    {
+      VOXEL_GRID,
+      RANDOM_SUBSAMPLE
+    };
+
+    VoxelFilter(Mode mode, double leaf_size, double keep_ratio, int threads);
+
+    /**
+     * @return false if the cloud has no float x, y and z fields
+     */
+    bool filter(const sensor_msgs::PointCloud2 &in, sensor_msgs::PointCloud2 &out);
+
+  private:
+    struct VoxelPoint
+    {
+      uint64_t key;
+      uint32_t index;
+      bool operator<(const VoxelPoint &other) const { return key < other.key; }
+    };
+
+    void computeKeys(int thread, size_t begin, size_t end);
+    void reducePartition(int partition);
+    void subsample(int thread, size_t begin, size_t end);
+
+    float coord(size_t index, int axis) const;
+
+    Mode mode_;
+    double leaf_size_;
+    double keep_ratio_;
+    int threads_;
+
+    // state of the current filter() call
+    const sensor_msgs::PointCloud2 *in_;
+    uint32_t offset_[3];
+    // [thread][partition] while keying, reused per partition while reducing
+    std::vector<std::vector<std::vector<VoxelPoint> > > buckets_;
+    std::vector<std::vector<uint8_t> > results_;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "revolution_log.h"
+
+void usage(char *pgrname)
+{
+  printf("%s: <logfile> [revolution]\n", pgrname);
+  printf("lists the revolutions in <logfile>.{rev,idx} or prints the points of one revolution\n");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2 || argc > 3) {
+    usage(argv[0]);
+    return 0;
+  }
+
+  RevolutionReader reader;
+  if (!reader.open(argv[1]))
+    return 1;
+
+  if (argc == 2) {
+    for (size_t i = 0; i < reader.size(); i++) {
+      const RevolutionIndexEntry &e = reader.entry(i);
+      printf("%zu: seq: %u stamp: %u.%09u points: %u size: %u pose: %f %f %f %f %f %f %f\n",
+          i, e.seq, e.stamp_sec, e.stamp_nsec, e.nr_points, e.compressed_size,
+          e.pose[0], e.pose[1], e.pose[2], e.pose[3], e.pose[4], e.pose[5], e.pose[6]);
+    }
+    return 0;
+  }
+
+  std::vector<float> points;
+  if (!reader.read(atoi(argv[2]), points))
+    return 1;
+  for (size_t i = 0; i + 2 < points.size(); i += 3)
+    printf("%f %f %f\n", points[i], points[i + 1], points[i + 2]);
+  return 0;
+}
@@ -0,0 +1,279 @@
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include <ros/console.h>
+#include <roslz4/lz4s.h>
+
+#include "revolution_log.h"
+
+// 1 MB LZ4 blocks
+#define REVOLUTION_LOG_BLOCK_SIZE_ID 6
+
+RevolutionWriter::RevolutionWriter(const std::string &filename, double resolution, size_t queue_size) :
+  data_file_(NULL),
+  index_file_(NULL),
+  offset_(REVOLUTION_LOG_MAGIC_SIZE),
+  seq_(0),
+  resolution_(resolution),
+  queue_size_(queue_size),
+  stop_(false)
+{
+  data_file_ = fopen((filename + ".rev").c_str(), "wb");
+  index_file_ = fopen((filename + ".idx").c_str(), "wb");
+  if (!isOpen())
+  {
+    ROS_ERROR("RevolutionWriter: Error opening %s.{rev,idx} (%s)", filename.c_str(), strerror(errno));
+    return;
+  }
+
+  fwrite(REVOLUTION_LOG_MAGIC, 1, REVOLUTION_LOG_MAGIC_SIZE, data_file_);
+  fwrite(REVOLUTION_LOG_MAGIC, 1, REVOLUTION_LOG_MAGIC_SIZE, index_file_);
+
+  thread_ = boost::thread(boost::bind(&RevolutionWriter::run, this));
+}
+
+RevolutionWriter::~RevolutionWriter()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+
+  if (data_file_)
+    fclose(data_file_);
+  if (index_file_)
+    fclose(index_file_);
+}
+
+bool RevolutionWriter::write(const sensor_msgs::PointCloud2::ConstPtr &cloud, const double pose[7])
+{
+  if (!isOpen())
+    return false;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (queue_.size() >= queue_size_)
+      return false;
+
+    Job job;
+    job.cloud = cloud;
+    memcpy(job.pose, pose, sizeof(job.pose));
+    queue_.push_back(job);
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void RevolutionWriter::run()
+{
+  while (true)
+  {
+    Job job;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (queue_.empty() && !stop_)
+        cond_.wait(lock);
+      // write all queued revolutions before stopping
+      if (queue_.empty())
+        return;
+      job = queue_.front();
+      queue_.pop_front();
+    }
+    writeJob(job);
+  }
+}
+
+void RevolutionWriter::writeJob(const Job &job)
+{
+  const sensor_msgs::PointCloud2 &cloud = *job.cloud;
+
+  const char *names[3] = {"x", "y", "z"};
+  uint32_t offset[3];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    size_t f = 0;
+    while (f < cloud.fields.size() && cloud.fields[f].name != names[axis])
+      f++;
+    if (f == cloud.fields.size() || cloud.fields[f].datatype != sensor_msgs::PointField::FLOAT32)
+    {
+      ROS_ERROR("RevolutionWriter: Cannot log cloud without float x, y and z fields");
+      return;
+    }
+    offset[axis] = cloud.fields[f].offset;
+  }
+
+  size_t nr_points = (size_t)cloud.width * cloud.height;
+  std::vector<int16_t> quantised;
+  quantised.reserve(nr_points * 3);
+  size_t out_of_range = 0;
+  for (size_t i = 0; i < nr_points; i++)
+  {
+    double q[3];
+    bool valid = true;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      float value;
+      memcpy(&value, &cloud.data[i * cloud.point_step + offset[axis]], sizeof(value));
+      q[axis] = floor((value - job.pose[axis]) / resolution_ + 0.5);
+      // also false for NaN
+      if (!(q[axis] >= -32768.0 && q[axis] <= 32767.0))
+        valid = false;
+    }
+    if (!valid)
+    {
+      out_of_range++;
+      continue;
+    }
+    for (int axis = 0; axis < 3; axis++)
+      quantised.push_back((int16_t)q[axis]);
+  }
+  if (out_of_range > 0)
+    ROS_DEBUG("RevolutionWriter: Dropped %zu invalid or out of range points", out_of_range);
+
+  unsigned int raw_size = quantised.size() * sizeof(int16_t);
+  // worst case LZ4 expansion plus frame overhead
+  unsigned int compressed_size = raw_size + raw_size / 255 + 1024;
+  std::vector<char> compressed(compressed_size);
+  if (raw_size > 0)
+  {
+    if (roslz4_buffToBuffCompress((char *)&quantised[0], raw_size, &compressed[0],
+          &compressed_size, REVOLUTION_LOG_BLOCK_SIZE_ID) != ROSLZ4_OK)
+    {
+      ROS_ERROR("RevolutionWriter: Error compressing revolution %u", seq_);
+      return;
+    }
+  }
+  else
+  {
+    compressed_size = 0;
+  }
+
+  RevolutionIndexEntry entry;
+  entry.seq = seq_++;
+  entry.stamp_sec = cloud.header.stamp.sec;
+  entry.stamp_nsec = cloud.header.stamp.nsec;
+  entry.nr_points = quantised.size() / 3;
+  memcpy(entry.pose, job.pose, sizeof(entry.pose));
+  entry.resolution = resolution_;
+  entry.offset = offset_;
+  entry.compressed_size = compressed_size;
+  entry.raw_size = raw_size;
+
+  if (fwrite(&compressed[0], 1, compressed_size, data_file_) != compressed_size ||
+      fwrite(&entry, sizeof(entry), 1, index_file_) != 1)
+  {
+    ROS_ERROR("RevolutionWriter: Error writing revolution %u (%s)", entry.seq, strerror(errno));
+    return;
+  }
+  // the index only points at data that has been flushed
+  fflush(data_file_);
+  fflush(index_file_);
+  offset_ += compressed_size;
+}
+
+RevolutionReader::RevolutionReader() :
+  data_(MAP_FAILED),
+  data_size_(0),
+  index_(MAP_FAILED),
+  index_size_(0),
+  entries_(NULL),
+  nr_entries_(0) { }
+
+RevolutionReader::~RevolutionReader()
+{
+  close();
+}
+
+static void *map_file(const std::string &filename, size_t *size)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    ROS_ERROR("RevolutionReader: Error opening %s (%s)", filename.c_str(), strerror(errno));
+    return MAP_FAILED;
+  }
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= REVOLUTION_LOG_MAGIC_SIZE)
+  {
+    *size = st.st_size;
+    map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+
+  if (map == MAP_FAILED || memcmp(map, REVOLUTION_LOG_MAGIC, REVOLUTION_LOG_MAGIC_SIZE) != 0)
+  {
+    ROS_ERROR("RevolutionReader: %s is not a revolution log", filename.c_str());
+    if (map != MAP_FAILED)
+      munmap(map, *size);
+    return MAP_FAILED;
+  }
+  return map;
+}
+
+bool RevolutionReader::open(const std::string &filename)
+{
+  close();
+
+  data_ = map_file(filename + ".rev", &data_size_);
+  index_ = map_file(filename + ".idx", &index_size_);
+  if (data_ == MAP_FAILED || index_ == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+
+  entries_ = (const RevolutionIndexEntry *)((const char *)index_ + REVOLUTION_LOG_MAGIC_SIZE);
+  nr_entries_ = (index_size_ - REVOLUTION_LOG_MAGIC_SIZE) / sizeof(RevolutionIndexEntry);
+  // a log that is still being written may end in a partial entry or block
+  while (nr_entries_ > 0 &&
+      entries_[nr_entries_ - 1].offset + entries_[nr_entries_ - 1].compressed_size > data_size_)
+    nr_entries_--;
+  return true;
+}
+
+void RevolutionReader::close()
+{
+  if (data_ != MAP_FAILED)
+    munmap(data_, data_size_);
+  if (index_ != MAP_FAILED)
+    munmap(index_, index_size_);
+  data_ = index_ = MAP_FAILED;
+  data_size_ = index_size_ = 0;
+  entries_ = NULL;
+  nr_entries_ = 0;
+}
+
+bool RevolutionReader::read(size_t i, std::vector<float> &points) const
+{
+  if (i >= nr_entries_)
+    return false;
+
+  const RevolutionIndexEntry &e = entries_[i];
+  std::vector<int16_t> quantised(e.raw_size / sizeof(int16_t));
+  unsigned int raw_size = e.raw_size;
+  if (raw_size > 0 &&
+      (roslz4_buffToBuffDecompress((char *)data_ + e.offset, e.compressed_size,
+                                   (char *)&quantised[0], &raw_size) != ROSLZ4_OK ||
+       raw_size != e.raw_size))
+  {
+    ROS_ERROR("RevolutionReader: Error decompressing revolution %u", e.seq);
+    return false;
+  }
+
+  points.resize(quantised.size());
+  for (size_t j = 0; j < quantised.size(); j++)
+    points[j] = quantised[j] * e.resolution + e.pose[j % 3];
+  return true;
+}
@@ -32,10 +32,23 @@
 *  POSSIBILITY OF SUCH DAMAGE.
 *********************************************************************/
 
+#include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <math.h>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 #include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <sensor_msgs/JointState.h>
+#include <std_msgs/Float64.h>
+#include <tf/transform_listener.h>
+
+#include "revolution_log.h"
+#include "voxel_filter.h"
 
 // Services
 #include "laser_assembler/AssembleScans2.h"
@@ -58,16 +71,98 @@ public:
 
   PeriodicSnapshotter()
   {
+    ros::NodeHandle nh_ns("~");
+
+    // angular size of the partial clouds (rad); 0 disables sector streaming
+    nh_ns.param("sector_angle", sector_angle_, 0.0);
+    if (sector_angle_ < 0.0 || sector_angle_ > 2 * M_PI)
+    {
+      ROS_WARN("sector_angle %f out of range (0, 2pi], disabling sector clouds", sector_angle_);
+      sector_angle_ = 0.0;
+    }
+    sectors_per_revolution_ = sector_angle_ > 0.0 ? (int)ceil(2 * M_PI / sector_angle_ - 1e-6) : 0;
+
+    // optional downsampling of the assembled cloud: none, voxel_grid or random
+    std::string filter;
+    nh_ns.param("filter", filter, std::string("none"));
+    double leaf_size, keep_ratio;
+    nh_ns.param("leaf_size", leaf_size, 0.05);
+    nh_ns.param("keep_ratio", keep_ratio, 0.25);
+    // number of filter threads; 0 uses all cores
+    int filter_threads;
+    nh_ns.param("filter_threads", filter_threads, 0);
+    // also publish the full density cloud when filtering
+    nh_ns.param("publish_full", publish_full_, true);
+
+    if (filter == "voxel_grid" && leaf_size > 0.0)
+      filter_.reset(new VoxelFilter(VoxelFilter::VOXEL_GRID, leaf_size, keep_ratio, filter_threads));
+    else if (filter == "random" && keep_ratio > 0.0 && keep_ratio <= 1.0)
+      filter_.reset(new VoxelFilter(VoxelFilter::RANDOM_SUBSAMPLE, leaf_size, keep_ratio, filter_threads));
+    else if (filter != "none")
+      ROS_WARN("Unknown filter %s or invalid filter parameters, publishing full clouds only", filter.c_str());
+    if (!filter_)
+      publish_full_ = true;
+
+    // write every revolution to <log_file>.{rev,idx}; empty disables logging
+    std::string log_file;
+    nh_ns.param("log_file", log_file, std::string(""));
+    double log_resolution;
+    nh_ns.param("log_resolution", log_resolution, 0.005);
+    int log_queue_size;
+    nh_ns.param("log_queue_size", log_queue_size, 4);
+    nh_ns.param("base_frame", base_frame_, std::string("base_link"));
+    if (!log_file.empty())
+    {
+      writer_.reset(new RevolutionWriter(log_file, log_resolution, std::max(1, log_queue_size)));
+      if (!writer_->isOpen())
+        writer_.reset();
+    }
+
     // Create a publisher for the clouds that we assemble
-    pub_ = n_.advertise<sensor_msgs::PointCloud2> ("assembled_cloud", 1);
+    if (publish_full_)
+      pub_ = n_.advertise<sensor_msgs::PointCloud2> ("assembled_cloud", 1);
+    if (filter_)
+      filtered_pub_ = n_.advertise<sensor_msgs::PointCloud2> ("assembled_cloud_filtered", 1);
+    if (sector_angle_ > 0.0)
+    {
+      sector_pub_ = n_.advertise<sensor_msgs::PointCloud2> ("sector_cloud", 1);
+      window_pub_ = n_.advertise<sensor_msgs::PointCloud2> ("sector_window_cloud", 1);
+    }
 
-    sub_ = n_.subscribe("joint_states", 1000, &PeriodicSnapshotter::rotCallback, this);
+    // time from the end of a revolution to the publication of its cloud
+    latency_pub_ = n_.advertise<std_msgs::Float64> ("revolution_latency", 10);
+    diagnostics_pub_ = n_.advertise<diagnostic_msgs::DiagnosticArray> ("diagnostics", 10);
+
+    // requests waiting for the assembler, a slow consumer drops the oldest
+    // revolution beyond this (default: two revolutions with their sectors)
+    nh_ns.param("max_queued_requests", max_queued_requests_, 2 * (sectors_per_revolution_ + 1));
+    max_queued_requests_ = std::max(1, max_queued_requests_);
+    dropped_revolutions_ = 0;
+    reported_drops_ = 0;
 
     // Create the service client for calling the assembler
     client_ = n_.serviceClient<AssembleScans2>("assemble_scans2");
 
     first_time_ = true;
     arm_ = false;
+    sector_ = -1;
+    stop_ = false;
+
+    // the assembler is called from the worker, so that joint states are
+    // processed at their full rate while a cloud is assembled
+    worker_ = boost::thread(boost::bind(&PeriodicSnapshotter::run, this));
+
+    sub_ = n_.subscribe("joint_states", 1000, &PeriodicSnapshotter::rotCallback, this);
+  }
+
+  ~PeriodicSnapshotter()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_one();
+    worker_.join();
   }
 
   /**
@@ -83,11 +178,208 @@ public:
     return -1;
   }
 
+  /**
+   * Appends the points of in to out. Both clouds come from the same assembler,
+   * so they share the same fields and point layout.
+   */
+  void appendCloud(sensor_msgs::PointCloud2 &out, const sensor_msgs::PointCloud2 &in)
+  {
+    if (out.data.empty())
+    {
+      out = in;
+    }
+    else
+    {
+      out.data.insert(out.data.end(), in.data.begin(), in.data.end());
+      out.width = out.width * out.height + in.width * in.height;
+      out.header.stamp = in.header.stamp;
+    }
+    out.height = 1;
+    out.row_step = out.width * out.point_step;
+  }
+
+  /**
+   * Publishes a sector cloud and the sliding window of the last full revolution.
+   */
+  void publishSector(const sensor_msgs::PointCloud2 &cloud)
+  {
+    sector_pub_.publish(cloud);
+
+    window_.push_back(cloud);
+    while ((int)window_.size() > sectors_per_revolution_)
+      window_.pop_front();
+
+    sensor_msgs::PointCloud2 window_cloud;
+    for (std::deque<sensor_msgs::PointCloud2>::const_iterator it = window_.begin(); it != window_.end(); ++it)
+      appendCloud(window_cloud, *it);
+    window_pub_.publish(window_cloud);
+  }
+
+  /**
+   * Hands the revolution and the robot pose at its end to the background writer.
+   */
+  void logRevolution(const sensor_msgs::PointCloud2 &cloud)
+  {
+    double pose[7] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0};
+    try
+    {
+      tf::StampedTransform transform;
+      tf_.waitForTransform(cloud.header.frame_id, base_frame_, cloud.header.stamp, ros::Duration(0.1));
+      tf_.lookupTransform(cloud.header.frame_id, base_frame_, cloud.header.stamp, transform);
+      pose[0] = transform.getOrigin().x();
+      pose[1] = transform.getOrigin().y();
+      pose[2] = transform.getOrigin().z();
+      pose[3] = transform.getRotation().x();
+      pose[4] = transform.getRotation().y();
+      pose[5] = transform.getRotation().z();
+      pose[6] = transform.getRotation().w();
+    }
+    catch (tf::TransformException &ex)
+    {
+      ROS_WARN("No pose for logged revolution: %s", ex.what());
+    }
+
+    if (!writer_->write(boost::make_shared<sensor_msgs::PointCloud2>(cloud), pose))
+      ROS_WARN("Revolution log queue full, dropping revolution");
+  }
+
+  void publishRevolution(const sensor_msgs::PointCloud2 &cloud, const ros::Time &end)
+  {
+    ROS_INFO("Published Cloud with %zu points", cloud.width * cloud.height) ;
+    if (publish_full_)
+      pub_.publish(cloud);
+    if (filter_)
+    {
+      sensor_msgs::PointCloud2 filtered;
+      if (filter_->filter(cloud, filtered))
+        filtered_pub_.publish(filtered);
+      else
+        ROS_ERROR("Cannot filter cloud without float x, y and z fields");
+    }
+
+    std_msgs::Float64 latency;
+    latency.data = (ros::Time::now() - end).toSec();
+    latency_pub_.publish(latency);
+    ROS_DEBUG("Revolution published %f s after its end", latency.data);
+    publishDiagnostics(latency.data);
+
+    if (writer_)
+      logRevolution(cloud);
+  }
+
+  /**
+   * Latency of the last published revolution, queue length and the
+   * revolutions dropped for a slow assembler (warning while they grow).
+   */
+  void publishDiagnostics(double latency)
+  {
+    size_t queued;
+    unsigned long dropped, new_drops;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queued = requests_.size();
+      dropped = dropped_revolutions_;
+      new_drops = dropped_revolutions_ - reported_drops_;
+      reported_drops_ = dropped_revolutions_;
+    }
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "rotunit_snapshotter: assembler";
+    status.level = new_drops > 0 ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = new_drops > 0 ? "falls behind, revolutions dropped" : "ok";
+
+    char buf[32];
+    diagnostic_msgs::KeyValue kv;
+    kv.key = "latency [s]";
+    snprintf(buf, sizeof(buf), "%.3f", latency);
+    kv.value = buf;
+    status.values.push_back(kv);
+    kv.key = "queued requests";
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)queued);
+    kv.value = buf;
+    status.values.push_back(kv);
+    kv.key = "dropped revolutions";
+    snprintf(buf, sizeof(buf), "%lu", dropped);
+    kv.value = buf;
+    status.values.push_back(kv);
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+    diagnostics_pub_.publish(msg);
+  }
+
+  /**
+   * Hands an interval to the worker that calls the assembler. A full queue
+   * drops the oldest revolution (its sectors stay for the window), or the
+   * oldest request if only sectors are queued.
+   */
+  void queueRequest(const ros::Time &begin, const ros::Time &end, bool sector)
+  {
+    AssemblyRequest request;
+    request.begin = begin;
+    request.end = end;
+    request.sector = sector;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (requests_.size() >= (size_t)max_queued_requests_)
+      {
+        std::deque<AssemblyRequest>::iterator oldest = requests_.begin();
+        while (oldest != requests_.end() && oldest->sector)
+          ++oldest;
+        if (oldest == requests_.end())
+          oldest = requests_.begin();
+        if (!oldest->sector)
+          dropped_revolutions_++;
+        requests_.erase(oldest);
+        ROS_WARN_THROTTLE(10, "Assembler falls behind, dropping the oldest request (%lu revolutions dropped)",
+            dropped_revolutions_);
+      }
+      requests_.push_back(request);
+    }
+    cond_.notify_one();
+  }
+
+  void run()
+  {
+    while (true)
+    {
+      AssemblyRequest request;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (requests_.empty() && !stop_)
+          cond_.wait(lock);
+        if (stop_)
+          return;
+        request = requests_.front();
+        requests_.pop_front();
+      }
+
+      // Populate our service request based on the detected interval
+      AssembleScans2 srv;
+      srv.request.begin = request.begin;
+      srv.request.end   = request.end;
+
+      // Make the service call
+      if (!client_.call(srv))
+      {
+        ROS_ERROR("Error making service call\n") ;
+        continue;
+      }
+
+      if (request.sector)
+        publishSector(srv.response.cloud);
+      else
+        publishRevolution(srv.response.cloud, request.end);
+    }
+  }
+
   void rotCallback(const sensor_msgs::JointState::ConstPtr& e)
   {
 
     if(first_time_) {
       last_time_ = e->header.stamp;
+      sector_start_ = e->header.stamp;
       first_time_ = false;
       return;
     }
@@ -96,7 +388,23 @@ public:
     if (index < 0)
       return;
 
+    // [0, 2pi), fmod keeps the sign of a negative angle
     double position = fmod(e->position[index], 2 * M_PI);
+    if (position < 0.0)
+      position += 2 * M_PI;
+
+    if (sector_angle_ > 0.0)
+    {
+      int sector = std::max(0, std::min((int)(position / sector_angle_), sectors_per_revolution_ - 1));
+      if (sector != sector_)
+      {
+        // the first boundary only starts the first complete sector
+        if (sector_ >= 0)
+          queueRequest(sector_start_, e->header.stamp, true);
+        sector_ = sector;
+        sector_start_ = e->header.stamp;
+      }
+    }
 
     if (!arm_ && position > 3) {
       arm_ = true;
@@ -104,22 +412,7 @@ public:
     }
 
     if(arm_ && position > 0 && position < 1) {
-
-      // Populate our service request based on our timer callback times
-      AssembleScans2 srv;
-      srv.request.begin = last_time_;
-      srv.request.end   = e->header.stamp;
-
-      // Make the service call
-      if (client_.call(srv))
-      {
-        ROS_INFO("Published Cloud with %zu points", srv.response.cloud.width * srv.response.cloud.height) ;
-        pub_.publish(srv.response.cloud);
-      }
-      else
-      {
-        ROS_ERROR("Error making service call\n") ;
-      }
+      queueRequest(last_time_, e->header.stamp, false);
 
       arm_ = false;
       last_time_ = e->header.stamp;
@@ -127,13 +420,50 @@ public:
   }
 
 private:
+  struct AssemblyRequest
+  {
+    ros::Time begin, end;
+    bool sector;
+  };
+
   ros::NodeHandle n_;
   ros::Publisher pub_;
+  ros::Publisher filtered_pub_;
+  ros::Publisher sector_pub_;
+  ros::Publisher window_pub_;
+  ros::Publisher latency_pub_;
+  ros::Publisher diagnostics_pub_;
   ros::Subscriber sub_;
   ros::ServiceClient client_;
   bool first_time_;
   bool arm_;
   ros::Time last_time_;
+
+  // downsampling
+  boost::scoped_ptr<VoxelFilter> filter_;
+  bool publish_full_;
+
+  // revolution log
+  boost::scoped_ptr<RevolutionWriter> writer_;
+  tf::TransformListener tf_;
+  std::string base_frame_;
+
+  // sector streaming
+  double sector_angle_;
+  int sectors_per_revolution_;
+  int sector_;
+  ros::Time sector_start_;
+  std::deque<sensor_msgs::PointCloud2> window_;
+
+  // assembler worker
+  std::deque<AssemblyRequest> requests_;
+  int max_queued_requests_;
+  unsigned long dropped_revolutions_;
+  unsigned long reported_drops_; // by the last diagnostics
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  bool stop_;
+  boost::thread worker_;
 } ;
 
 }
@@ -148,6 +478,8 @@ int main(int argc, char **argv)
   ros::service::waitForService("assemble_scans2");
   ROS_INFO("Found assemble_scans2! Starting the snapshotter");
   PeriodicSnapshotter snapshotter;
-  ros::spin();
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ros::waitForShutdown();
   return 0;
 }
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "voxel_filter.h"
+
+// voxel coordinates are packed into 21 bits each
+#define VOXEL_BITS     21
+#define VOXEL_OFFSET   (1 << (VOXEL_BITS - 1))
+#define VOXEL_MASK     ((1 << VOXEL_BITS) - 1)
+
+VoxelFilter::VoxelFilter(Mode mode, double leaf_size, double keep_ratio, int threads) :
+  mode_(mode),
+  leaf_size_(leaf_size),
+  keep_ratio_(keep_ratio),
+  threads_(threads > 0 ? threads : std::max(1u, boost::thread::hardware_concurrency())),
+  in_(NULL) { }
+
+float VoxelFilter::coord(size_t index, int axis) const
+{
+  float value;
+  memcpy(&value, &in_->data[index * in_->point_step + offset_[axis]], sizeof(value));
+  return value;
+}
+
+void VoxelFilter::computeKeys(int thread, size_t begin, size_t end)
+{
+  std::vector<std::vector<VoxelPoint> > &buckets = buckets_[thread];
+  buckets.assign(threads_, std::vector<VoxelPoint>());
+  for (int p = 0; p < threads_; p++)
+    buckets[p].reserve((end - begin) / threads_ + 1);
+
+  for (size_t i = begin; i < end; i++)
+  {
+    float p[3] = {coord(i, 0), coord(i, 1), coord(i, 2)};
+    // inf and nan have no voxel
+    if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2]))
+      continue;
+
+    VoxelPoint point;
+    point.key = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      // clamped before the cast, a far point would overflow the long
+      double v = floor(p[axis] / leaf_size_) + VOXEL_OFFSET;
+      point.key = (point.key << VOXEL_BITS) | (uint64_t)(std::max(0.0, std::min((double)VOXEL_MASK, v)));
+    }
+    point.index = i;
+
+    // fibonacci hashing spreads neighbouring voxels over the partitions
+    int partition = (int)(((point.key * 0x9E3779B97F4A7C15ULL) >> 32) % threads_);
+    buckets[partition].push_back(point);
+  }
+}
+
+void VoxelFilter::reducePartition(int partition)
+{
+  std::vector<VoxelPoint> points;
+  size_t size = 0;
+  for (int t = 0; t < threads_; t++)
+    size += buckets_[t][partition].size();
+  points.reserve(size);
+  for (int t = 0; t < threads_; t++)
+  {
+    points.insert(points.end(), buckets_[t][partition].begin(), buckets_[t][partition].end());
+    std::vector<VoxelPoint>().swap(buckets_[t][partition]);
+  }
+
+  std::sort(points.begin(), points.end());
+
+  const uint32_t step = in_->point_step;
+  std::vector<uint8_t> &result = results_[partition];
+  result.clear();
+
+  size_t i = 0;
+  while (i < points.size())
+  {
+    size_t j = i;
+    double sum[3] = {0.0, 0.0, 0.0};
+    for (; j < points.size() && points[j].key == points[i].key; j++)
+      for (int axis = 0; axis < 3; axis++)
+        sum[axis] += coord(points[j].index, axis);
+
+    // keep the remaining fields (e.g. intensity) of the first point in the voxel
+    size_t out = result.size();
+    const uint8_t *first = &in_->data[points[i].index * step];
+    result.insert(result.end(), first, first + step);
+    for (int axis = 0; axis < 3; axis++)
+    {
+      float centroid = (float)(sum[axis] / (j - i));
+      memcpy(&result[out + offset_[axis]], &centroid, sizeof(centroid));
+    }
+    i = j;
+  }
+}
+
+void VoxelFilter::subsample(int thread, size_t begin, size_t end)
+{
+  unsigned int seed = (thread + 1) * 2654435761u ^ in_->header.stamp.nsec;
+  const uint32_t step = in_->point_step;
+  std::vector<uint8_t> &result = results_[thread];
+  result.clear();
+  result.reserve((size_t)((end - begin) * keep_ratio_ * 1.1) * step);
+
+  const uint8_t *data = &in_->data[0];
+  for (size_t i = begin; i < end; i++)
+  {
+    if (rand_r(&seed) < keep_ratio_ * RAND_MAX)
+      result.insert(result.end(), data + i * step, data + (i + 1) * step);
+  }
+}
+
+bool VoxelFilter::filter(const sensor_msgs::PointCloud2 &in, sensor_msgs::PointCloud2 &out)
+{
+  const char *names[3] = {"x", "y", "z"};
+  for (int axis = 0; axis < 3; axis++)
+  {
+    size_t f = 0;
+    while (f < in.fields.size() && in.fields[f].name != names[axis])
+      f++;
+    if (f == in.fields.size() || in.fields[f].datatype != sensor_msgs::PointField::FLOAT32)
+      return false;
+    offset_[axis] = in.fields[f].offset;
+  }
+  in_ = &in;
+
+  size_t nr_points = (size_t)in.width * in.height;
+  size_t chunk = (nr_points + threads_ - 1) / threads_;
+  results_.assign(threads_, std::vector<uint8_t>());
+
+  if (mode_ == VOXEL_GRID)
+  {
+    buckets_.resize(threads_);
+
+    boost::thread_group keying;
+    for (int t = 0; t < threads_; t++)
+      keying.create_thread(boost::bind(&VoxelFilter::computeKeys, this, t,
+            std::min(nr_points, t * chunk), std::min(nr_points, (t + 1) * chunk)));
+    keying.join_all();
+
+    boost::thread_group reducing;
+    for (int p = 0; p < threads_; p++)
+      reducing.create_thread(boost::bind(&VoxelFilter::reducePartition, this, p));
+    reducing.join_all();
+  }
+  else
+  {
+    boost::thread_group sampling;
+    for (int t = 0; t < threads_; t++)
+      sampling.create_thread(boost::bind(&VoxelFilter::subsample, this, t,
+            std::min(nr_points, t * chunk), std::min(nr_points, (t + 1) * chunk)));
+    sampling.join_all();
+  }
+
+  out.header = in.header;
+  out.fields = in.fields;
+  out.is_bigendian = in.is_bigendian;
+  out.is_dense = in.is_dense;
+  out.point_step = in.point_step;
+  out.height = 1;
+
+  size_t size = 0;
+  for (int t = 0; t < threads_; t++)
+    size += results_[t].size();
+  out.data.clear();
+  out.data.reserve(size);
+  for (int t = 0; t < threads_; t++)
+  {
+    out.data.insert(out.data.end(), results_[t].begin(), results_[t].end());
+    std::vector<uint8_t>().swap(results_[t]);
+  }
+  out.width = in.point_step > 0 ? out.data.size() / in.point_step : 0;
+  out.row_step = out.width * out.point_step;
+
+  in_ = NULL;
+  return true;
+}